@@ -8,7 +8,7 @@
 	Link:
 		http://arduino.cc/de/Reference/SoftwareSerial
 	
-	Base64 library by Adam Rudd
+	The base64 coding is built in, it is based on the Base64 library by Adam Rudd
 	Link:
 		https://github.com/adamvr/arduino-base64
 
@@ -43,20 +43,109 @@
 	
 #include <MessageComLite.h>
 
+// CRC-32C instructions of the host CPU
+#if defined(__SSE4_2__)
+	#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+	#include <arm_acle.h>
+#endif
+
+// base64 alphabet
+static const uint8_t MCBASE64ALPHABET[] PROGMEM =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+// base64 values of the chars '+' (43) to 'z' (122), 0xFF marks chars outside the alphabet
+static const uint8_t MCBASE64LOOKUP[] PROGMEM = {
+	0x3E, 0xFF, 0xFF, 0xFF, 0x3F, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09,
+	0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23,
+	0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33
+};
+// CRC-32C (Castagnoli, reflected) of every nibble, the fallback without CRC instructions
+static const uint32_t MCCRC32CNIBBLE[] PROGMEM = {
+	0x00000000, 0x105EC76F, 0x20BD8EDE, 0x30E349B1, 0x417B1DBC, 0x5125DAD3, 0x61C69362, 0x7198540D,
+	0x82F63B78, 0x92A8FC17, 0xA24BB5A6, 0xB21572C9, 0xC38D26C4, 0xD3D3E1AB, 0xE330A81A, 0xF36E6F75
+};
+// GF(256) with the polynomial 0x11D: powers of alpha (the last one wraps around) and their logarithms
+static const uint8_t MCFECEXP[] PROGMEM = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1D, 0x3A, 0x74, 0xE8, 0xCD, 0x87, 0x13, 0x26,
+	0x4C, 0x98, 0x2D, 0x5A, 0xB4, 0x75, 0xEA, 0xC9, 0x8F, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xC0,
+	0x9D, 0x27, 0x4E, 0x9C, 0x25, 0x4A, 0x94, 0x35, 0x6A, 0xD4, 0xB5, 0x77, 0xEE, 0xC1, 0x9F, 0x23,
+	0x46, 0x8C, 0x05, 0x0A, 0x14, 0x28, 0x50, 0xA0, 0x5D, 0xBA, 0x69, 0xD2, 0xB9, 0x6F, 0xDE, 0xA1,
+	0x5F, 0xBE, 0x61, 0xC2, 0x99, 0x2F, 0x5E, 0xBC, 0x65, 0xCA, 0x89, 0x0F, 0x1E, 0x3C, 0x78, 0xF0,
+	0xFD, 0xE7, 0xD3, 0xBB, 0x6B, 0xD6, 0xB1, 0x7F, 0xFE, 0xE1, 0xDF, 0xA3, 0x5B, 0xB6, 0x71, 0xE2,
+	0xD9, 0xAF, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0D, 0x1A, 0x34, 0x68, 0xD0, 0xBD, 0x67, 0xCE,
+	0x81, 0x1F, 0x3E, 0x7C, 0xF8, 0xED, 0xC7, 0x93, 0x3B, 0x76, 0xEC, 0xC5, 0x97, 0x33, 0x66, 0xCC,
+	0x85, 0x17, 0x2E, 0x5C, 0xB8, 0x6D, 0xDA, 0xA9, 0x4F, 0x9E, 0x21, 0x42, 0x84, 0x15, 0x2A, 0x54,
+	0xA8, 0x4D, 0x9A, 0x29, 0x52, 0xA4, 0x55, 0xAA, 0x49, 0x92, 0x39, 0x72, 0xE4, 0xD5, 0xB7, 0x73,
+	0xE6, 0xD1, 0xBF, 0x63, 0xC6, 0x91, 0x3F, 0x7E, 0xFC, 0xE5, 0xD7, 0xB3, 0x7B, 0xF6, 0xF1, 0xFF,
+	0xE3, 0xDB, 0xAB, 0x4B, 0x96, 0x31, 0x62, 0xC4, 0x95, 0x37, 0x6E, 0xDC, 0xA5, 0x57, 0xAE, 0x41,
+	0x82, 0x19, 0x32, 0x64, 0xC8, 0x8D, 0x07, 0x0E, 0x1C, 0x38, 0x70, 0xE0, 0xDD, 0xA7, 0x53, 0xA6,
+	0x51, 0xA2, 0x59, 0xB2, 0x79, 0xF2, 0xF9, 0xEF, 0xC3, 0x9B, 0x2B, 0x56, 0xAC, 0x45, 0x8A, 0x09,
+	0x12, 0x24, 0x48, 0x90, 0x3D, 0x7A, 0xF4, 0xF5, 0xF7, 0xF3, 0xFB, 0xEB, 0xCB, 0x8B, 0x0B, 0x16,
+	0x2C, 0x58, 0xB0, 0x7D, 0xFA, 0xE9, 0xCF, 0x83, 0x1B, 0x36, 0x6C, 0xD8, 0xAD, 0x47, 0x8E, 0x01
+};
+static const uint8_t MCFECLOG[] PROGMEM = {
+	0x00, 0x00, 0x01, 0x19, 0x02, 0x32, 0x1A, 0xC6, 0x03, 0xDF, 0x33, 0xEE, 0x1B, 0x68, 0xC7, 0x4B,
+	0x04, 0x64, 0xE0, 0x0E, 0x34, 0x8D, 0xEF, 0x81, 0x1C, 0xC1, 0x69, 0xF8, 0xC8, 0x08, 0x4C, 0x71,
+	0x05, 0x8A, 0x65, 0x2F, 0xE1, 0x24, 0x0F, 0x21, 0x35, 0x93, 0x8E, 0xDA, 0xF0, 0x12, 0x82, 0x45,
+	0x1D, 0xB5, 0xC2, 0x7D, 0x6A, 0x27, 0xF9, 0xB9, 0xC9, 0x9A, 0x09, 0x78, 0x4D, 0xE4, 0x72, 0xA6,
+	0x06, 0xBF, 0x8B, 0x62, 0x66, 0xDD, 0x30, 0xFD, 0xE2, 0x98, 0x25, 0xB3, 0x10, 0x91, 0x22, 0x88,
+	0x36, 0xD0, 0x94, 0xCE, 0x8F, 0x96, 0xDB, 0xBD, 0xF1, 0xD2, 0x13, 0x5C, 0x83, 0x38, 0x46, 0x40,
+	0x1E, 0x42, 0xB6, 0xA3, 0xC3, 0x48, 0x7E, 0x6E, 0x6B, 0x3A, 0x28, 0x54, 0xFA, 0x85, 0xBA, 0x3D,
+	0xCA, 0x5E, 0x9B, 0x9F, 0x0A, 0x15, 0x79, 0x2B, 0x4E, 0xD4, 0xE5, 0xAC, 0x73, 0xF3, 0xA7, 0x57,
+	0x07, 0x70, 0xC0, 0xF7, 0x8C, 0x80, 0x63, 0x0D, 0x67, 0x4A, 0xDE, 0xED, 0x31, 0xC5, 0xFE, 0x18,
+	0xE3, 0xA5, 0x99, 0x77, 0x26, 0xB8, 0xB4, 0x7C, 0x11, 0x44, 0x92, 0xD9, 0x23, 0x20, 0x89, 0x2E,
+	0x37, 0x3F, 0xD1, 0x5B, 0x95, 0xBC, 0xCF, 0xCD, 0x90, 0x87, 0x97, 0xB2, 0xDC, 0xFC, 0xBE, 0x61,
+	0xF2, 0x56, 0xD3, 0xAB, 0x14, 0x2A, 0x5D, 0x9E, 0x84, 0x3C, 0x39, 0x53, 0x47, 0x6D, 0x41, 0xA2,
+	0x1F, 0x2D, 0x43, 0xD8, 0xB7, 0x7B, 0xA4, 0x76, 0xC4, 0x17, 0x49, 0xEC, 0x7F, 0x0C, 0x6F, 0xF6,
+	0x6C, 0xA1, 0x3B, 0x52, 0x29, 0x9D, 0x55, 0xAA, 0xFB, 0x60, 0x86, 0xB1, 0xBB, 0xCC, 0x3E, 0x5A,
+	0xCB, 0x59, 0x5F, 0xB0, 0x9C, 0xA9, 0xA0, 0x51, 0x0B, 0xF5, 0x16, 0xEB, 0x7A, 0x75, 0x2C, 0xD7,
+	0x4F, 0xAE, 0xD5, 0xE9, 0xE6, 0xE7, 0xAD, 0xE8, 0x74, 0xD6, 0xF4, 0xEA, 0xA8, 0x50, 0x58, 0xAF
+};
+
 // private
-int MessageComLite::indexOf(uint8_t *array, uint8_t value, uint8_t startPos, uint8_t endPos) {
+int MessageComLite::indexOf(uint8_t *array, uint8_t value, MCSize startPos, MCSize endPos) {
 	if(endPos == 0)
 		endPos = _maxSize;
-	for(uint8_t pos=startPos; pos<=endPos; pos++) {
-		
-		if(array[pos]==value)
-			return pos;
+	if(startPos > endPos)
+		return -1;
+
+	// memchr is hand written assembler in avr-libc and vectorized in the libc of a host
+	uint8_t *pos = (uint8_t*) memchr(&array[startPos], value, (endPos-startPos+1));
+	if(pos == NULL)
+		return -1;
+	return (pos-array);
+}
+MCSize MessageComLite::getDataSpace() {
+	// bytes a new field can take, the whole frame has to fit into the frame of the peer
+	// counted in a long, so a full _dataSize can not wrap around
+	unsigned long used = (MCHEADERSIZE+checkSizeOf(_check));
+	if(_dataSize > 0)
+		used += (_dataSize+1);
+	// with error correction every frame carries its parity, MCFECPARITY bytes per block of up to 255 bytes
+	unsigned long limit = _linkMaxSize;
+	if(_fec) {
+		unsigned long parity = (((limit+254)/255)*MCFECPARITY);
+		limit = ((limit > parity) ? (limit-parity) : 0);
 	}
-	return -1;
+	if(used >= limit)
+		return 0;
+	return (MCSize) (limit-used);
 }
-uint8_t MessageComLite::extendDataTo(uint8_t bytes) {
+uint8_t MessageComLite::extendDataTo(MCSize bytes) {
 	uint8_t retValue = 0;
 
+	// check the space first, _dataSize is only extended if the field fits
+	if(bytes > getDataSpace())
+		return 0;
+#ifdef MCLARGEFRAMES
+	// only a large frame has room for more fields than an index can reach,
+	// the count is not needed below the smallest data that holds MCMAXFIELDS fields
+	if(_dataSize >= ((2*MCMAXFIELDS)-1) && getDataCount() >= MCMAXFIELDS)
+		return 0;
+#endif
+
 	if(_dataSize == 0) {
 		_dataSize = bytes;
 		retValue = 1;
@@ -64,16 +153,31 @@ uint8_t MessageComLite::extendDataTo(uint8_t bytes) {
 		_dataSize += (bytes+1);
 		retValue = 2;
 	}
-
-	if(_dataSize <= _maxSize)
-		return retValue;
-	return 0;
-}
-void MessageComLite::getPositionsOfIndexFromData(uint8_t index, uint8_t &len, int &start, int &stop) {
+	return retValue;
+}
+boolean MessageComLite::isArrayAt(MCSize pos) {
+	// an array field is marked by the delimiter in front of its size (MCSIZEBYTES, high byte first)
+	return ((pos+MCSIZEBYTES) < _dataSize && _data[pos] == _delimiter);
+}
+MCSize MessageComLite::getArrayEndAt(MCSize pos) {
+	// the delimiter search of a field starts behind the values of an array, they may contain the delimiter
+	if(!isArrayAt(pos))
+		return pos;
+#ifdef MCLARGEFRAMES
+	unsigned long end = (((MCSize) _data[(pos+1)] << 8) | _data[(pos+2)]);
+#else
+	unsigned long end = _data[(pos+1)];
+#endif
+	end += (pos+1+MCSIZEBYTES);
+	return (end < _dataSize) ? (MCSize) end : _dataSize;
+}
+void MessageComLite::getPositionsOfIndexFromData(uint8_t index, MCSize &len, int &start, int &stop) {
 	len = 0, start = 0, stop = 0;
 
 	for(uint8_t i=0; i<=index; i++) {
-		if((stop = indexOf(_data, _delimiter, start, _dataSize)) < 0) {
+		// indexOf includes the end position, the checksum behind the data is no delimiter
+		stop = indexOf(_data, _delimiter, getArrayEndAt(start), _dataSize);
+		if(stop < 0 || stop >= _dataSize) {
 			stop = _dataSize;
 			break;
 		}
@@ -81,6 +185,9 @@ void MessageComLite::getPositionsOfIndexFromData(uint8_t index, uint8_t &len, in
 			break;
 		start = stop+1;
 	}
+	// the field of an array starts at its values
+	if(isArrayAt(start))
+		start += (1+MCSIZEBYTES);
 
 	len = ((stop-start)+1);
 }
@@ -88,32 +195,1000 @@ boolean MessageComLite::bytePlausible(uint8_t value) {
 	// _startDelimiter || _stopDelimiter || + || / || 0 to 9 || = || A to Z || a to z
 	// in regular messages ackChar and nackChar is not plausible char
 	// ackChar and nackChar is just used for acknowledgements
-	if(value == _startDelimiter || value == _stopDelimiter ||
-		value == 43 || value == 47 || (48 <= value && value <= 57) || value == 61 ||
-		(65 <= value && value <= 90) || (97 <= value && value <= 122))
+	// letters are by far the most frequent bytes, so test them first
+	// (value|0x20) folds A to Z onto a to z, the unsigned subtraction turns each range into one compare
+	if((uint8_t) ((value|0x20)-97) < 26 || (uint8_t) (value-48) < 10)
+		return 1;
+	if(value == 43 || value == 47 || value == 61 || value == MCFECMARK ||
+		value == _startDelimiter || value == _stopDelimiter)
+		return 1;
+	return 0;
+}
+boolean MessageComLite::byteInFrame(uint8_t value) {
+	// with error correction a garbled char is kept, so the chars behind it keep their position
+	// 0xFF: nothing received, ackChar and nackChar are never part of a message
+	if(_fec)
+		return (value != 0xFF && value != _ackChar && value != _nackChar);
+	return bytePlausible(value);
+}
+void MessageComLite::skipBytes(MCSize bytes) {
+	while(bytes--)
+		readByte();
+}
+boolean MessageComLite::skipEcho(uint8_t value) {
+	// a half-duplex line echoes the sent message: skip the bytes as long as they match it,
+	// so on a line without echo the acknowledgement is never taken for it
+	// 0xFF: nothing received yet, the echo may still come
+	if(_echoPos >= _echoSize || value == 0xFF)
+		return 0;
+	while(_echoPos < _echoSize && !bytePlausible(_echoFrame[_echoPos]))
+		_echoPos++;
+	if(_echoPos < _echoSize && value == _echoFrame[_echoPos]) {
+		_echoPos++;
+		while(_echoPos < _echoSize && !bytePlausible(_echoFrame[_echoPos]))
+			_echoPos++;
+		// the whole message came back: the line echoes, the own acknowledgements as well
+		if(_echoPos == _echoSize)
+			_echoLine = 1;
 		return 1;
+	}
+	// no echo: the matched bytes belong to a message of the peer
+	MCSize matched = _echoPos;
+	_echoPos = _echoSize;
+	_echoLine = 0;
+	for(MCSize i=0; i<matched; i++) {
+		if(bytePlausible(_echoFrame[i]))
+			queueByte(_echoFrame[i]);
+	}
 	return 0;
 }
-void MessageComLite::skipBytes(uint8_t bytes) {
+
+void MessageComLite::waitEcho(MCSize size) {
+	// nobody answers a message to a group or to all nodes, only its echo is skipped,
+	// a line without echo ends the wait with the first other byte or after MCTIMER
+	unsigned long start = millis();
+	unsigned long timeout = (MCTIMER+wireTime(size));
+	while(_echoPos < _echoSize && (millis()-start) < timeout) {
+		if(!available()) {
+			delay(1);
+			continue;
+		}
+		uint8_t value = (uint8_t) readByte();
+		// the bytes of the peer meanwhile go to the receive queue
+		if(!skipEcho(value))
+			queueByte(value);
+	}
+	captureFlush();
+}
+unsigned long MessageComLite::wireTime(MCSize size) {
+	// ms the serial buffer may still need for size chars and the line end, 10 bits per char
+	if(_baud == 0)
+		return 0;
+	return (((unsigned long) (size+2)*10000UL)/_baud);
+}
+
+// transport: every byte passes these methods, so they are the place to capture it
+int MessageComLite::available() {
 	if(_Serial != NULL)
-		while(bytes--)
-			_Serial->read();
+		return _Serial->available();
 	else if(_swSerial != NULL)
-		while(bytes--)
-			_swSerial->read();
+		return _swSerial->available();
+	return 0;
 }
+int MessageComLite::readByte() {
+	int value = -1;
+	if(_Serial != NULL)
+		value = _Serial->read();
+	else if(_swSerial != NULL)
+		value = _swSerial->read();
+
+	// read() returns -1 if nothing was received, there is nothing to capture then
+	if(_capture != NULL && value > -1)
+		captureByte(MCCAPTURERX, (uint8_t) value);
+
+	// the echo of the own acknowledgement is no acknowledgement of the peer
+	if(value == _ackChar && _echoAcks > 0) {
+		_echoAcks--;
+		return -1;
+	} else if(value == _nackChar && _echoNacks > 0) {
+		_echoNacks--;
+		return -1;
+	}
+	return value;
+}
+void MessageComLite::writeByte(uint8_t value) {
+	if(_Serial != NULL)
+		_Serial->write(value);
+	else if(_swSerial != NULL)
+		_swSerial->write(value);
 
+	if(_capture != NULL)
+		captureByte(MCCAPTURETX, value);
+}
 
+// queue
+uint8_t* MessageComLite::getQueueSlot(uint8_t *queue, uint8_t slot) {
+	return &queue[(slot*(MCQUEUEHEADER+_bufferMaxSize))];
+}
+MCSize MessageComLite::getSlotSize(uint8_t *slot) {
+	// the size of the message in a slot, with large frames high byte first
+#ifdef MCLARGEFRAMES
+	return (((MCSize) slot[4] << 8) | slot[5]);
+#else
+	return slot[4];
+#endif
+}
+void MessageComLite::setSlotSize(uint8_t *slot, MCSize size) {
+#ifdef MCLARGEFRAMES
+	slot[4] = (uint8_t) (size >> 8);
+	slot[5] = (uint8_t) size;
+#else
+	slot[4] = size;
+#endif
+}
 
-// public
-MessageComLite::MessageComLite(HardwareSerial &hwSerial, uint8_t *buffer, uint8_t buffer_maxSize, uint8_t *msg, uint8_t maxSize) {
+// link
+boolean MessageComLite::createLinkMessage(uint8_t taskValue) {
+	clear();
+	// data: maxSize | features | maxBaud (4 byte, high byte first)
+	// one array field, a delimiter could be part of the values
+	// with large frames maxSize takes 2 bytes, high byte first
+	uint8_t caps[(MCSIZEBYTES+5)];
+	uint8_t pos = 0;
+#ifdef MCLARGEFRAMES
+	caps[pos++] = (uint8_t) (_maxSize >> 8);
+#endif
+	caps[pos++] = (uint8_t) _maxSize;
+	caps[pos++] = _features;
+	caps[pos++] = (uint8_t) (_maxBaud >> 24);
+	caps[pos++] = (uint8_t) (_maxBaud >> 16);
+	caps[pos++] = (uint8_t) (_maxBaud >> 8);
+	caps[pos++] = (uint8_t) _maxBaud;
+	if(!addArrayToData(caps, pos))
+		return 0;
+
+	// the handshake itself always uses the regular header
+	boolean compact = _compact;
+	_compact = 0;
+	_type = MCTYPELINK;
+	createMessage(taskValue, 1);
+	_compact = compact;
+	return 1;
+}
+boolean MessageComLite::readLinkMessage(MCSize &maxSize, uint8_t &features, unsigned long &maxBaud) {
+	uint8_t caps[(MCSIZEBYTES+5)];
+	if(_type != MCTYPELINK || getArrayFromData(0, caps, (MCSIZEBYTES+5)) < (MCSIZEBYTES+5))
+		return 0;
+#ifdef MCLARGEFRAMES
+	maxSize = (((MCSize) caps[0] << 8) | caps[1]);
+#else
+	maxSize = caps[0];
+#endif
+	features = caps[MCSIZEBYTES];
+	maxBaud = (((unsigned long) caps[(MCSIZEBYTES+1)] << 24) | ((unsigned long) caps[(MCSIZEBYTES+2)] << 16) |
+		((unsigned long) caps[(MCSIZEBYTES+3)] << 8) | caps[(MCSIZEBYTES+4)]);
+	return 1;
+}
+void MessageComLite::useLink(MCSize maxSize, uint8_t features, unsigned long maxBaud) {
+	// both sides come to the same result: the best common settings
+	_linkMaxSize = min(_maxSize, maxSize);
+	_linkFeatures = (_features & features);
+	_compact = ((_linkFeatures & MCFEATCOMPACT) != 0);
+	_check = checkOf(_linkFeatures);
+	_fec = ((_linkFeatures & MCFEATFEC) != 0);
+	_ackFrame = ((_linkFeatures & MCFEATACKFRAME) != 0);
+	_templateValid = 0;
+	_failCount = 0;
+	_lastLife = millis();
+	_awaitLife = 0;
+	if(_maxBaud > 0 && maxBaud > 0)
+		setBaud(min(_maxBaud, maxBaud));
+}
+void MessageComLite::setBaud(unsigned long baud) {
+	if(baud == 0 || baud == _baud)
+		return;
+	// flush waits for the outgoing bytes, they still belong to the old baud rate
+	if(_Serial != NULL) {
+		_Serial->flush();
+		_Serial->begin(baud);
+	} else if(_swSerial != NULL) {
+		_swSerial->flush();
+		_swSerial->begin(baud);
+	}
+	_baud = baud;
+}
+void MessageComLite::linkFailed() {
+	// nothing negotiated, nothing to fall back from
+	if(_baud == _baseBaud && _linkFeatures == 0)
+		return;
+	if(++_failCount >= MCLINKMAXFAIL)
+		linkDown();
+}
+void MessageComLite::linkSilent() {
+	// a peer that fell back can not be heard any more: follow it after a while,
+	// but only while it owes an answer, a quiet peer is no reason to fall back
+	if(!_awaitLife || (_baud == _baseBaud && _linkFeatures == 0))
+		return;
+	if((millis()-_lastLife) >= MCLINKSILENCE)
+		linkDown();
+}
+void MessageComLite::awaitLife() {
+	// the silence counts from the first message the peer leaves unanswered
+	if(_awaitLife)
+		return;
+	_awaitLife = 1;
+	_lastLife = millis();
+}
+
+// receive queue
+void MessageComLite::queueByte(uint8_t value) {
+	// collect a message of the peer while waiting for an acknowledgement
+	if(_rxQueue == NULL)
+		return;
+
+	if(value == _startDelimiter) {
+		// every start begins a new message, in the same slot if there is one
+		if(_rxSlot == 0xFF) {
+			for(uint8_t i=0; i<_rxSlots; i++) {
+				if(getQueueSlot(_rxQueue, i)[0] == 0) {
+					_rxSlot = i;
+					break;
+				}
+			}
+			// queue is full: the message is dropped, the peer sends it again
+			if(_rxSlot == 0xFF)
+				return;
+		}
+		_rxPos = 0;
+		getQueueSlot(_rxQueue, _rxSlot)[(MCQUEUEHEADER+_rxPos++)] = value;
+		return;
+	}
+	// outside of a message
+	if(_rxSlot == 0xFF)
+		return;
+
+	uint8_t *slot = getQueueSlot(_rxQueue, _rxSlot);
+	if(value == _stopDelimiter) {
+		_rxSlot = 0xFF;
+		// acknowledge it at once, the acknowledgement just goes in between the own traffic
+		uint8_t state = checkQueued(slot, _rxPos);
+		// a message to a group or to all nodes is not acknowledged, the answers would collide
+		boolean silent = ((getDestinationFrom(&slot[MCQUEUEHEADER]) & MCGROUP) != 0);
+		if(state == MCQUEUEREADY) {
+			slot[0] = MCQUEUEREADY;
+			slot[1] = _rxOrder++;
+			_lastLife = millis();
+			_awaitLife = 0;
+			if(!silent)
+				sendAck(1);
+		} else if(state == MCQUEUENACK && !silent) {
+			sendAck(0);
+		}
+	} else if(byteInFrame(value)) {
+		// too long for the slot: drop it
+		if(_rxPos >= (_bufferMaxSize-1))
+			_rxSlot = 0xFF;
+		else
+			slot[(MCQUEUEHEADER+_rxPos++)] = value;
+	}
+}
+uint8_t MessageComLite::checkQueued(uint8_t *slot, MCSize encodedLen) {
+	// verify a queued message in its slot, _msg still holds the sent message
+	// slot: state | order | headerSize | size | decoded message
+	uint8_t *frame = &slot[MCQUEUEHEADER];
+	// the chars behind the start delimiter, without the mark of the parity
+	MCSize chars = (encodedLen-1);
+	boolean parity = (chars > 0 && frame[chars] == MCFECMARK);
+	if(parity)
+		chars--;
+
+	// a message to another node is neither queued nor answered,
+	// the destination is in the first quad, so such a message is neither corrected nor decoded
+	uint8_t header[3];
+	if(chars >= 4 && base64DecodeQuad(header, &frame[1]) == 3 && !addressedToMe(getDestinationFrom(header)))
+		return 0;
+	if(parity) {
+		MCSize corrected = fecCorrect(&frame[1], chars);
+		// more wrong bytes than the parity can correct
+		if(corrected >= chars)
+			return 0;
+		chars = corrected;
+	}
+	// decode in place, behind the start delimiter
+	MCSize len = base64Decode(frame, &frame[1], chars);
+	if(len < 4)
+		return 0;
+
+	uint8_t destination = getDestinationFrom(frame);
+	if(!addressedToMe(destination))
+		return 0;
+
+	uint8_t headerSize = MCHEADERSIZE, cmdStatus = 0;
+	uint8_t checkSize = checkSizeOf(_check);
+	MCSize dataSize = 0;
+	if(frame[0] & MCCOMPACT) {
+		headerSize = compactHeaderSize(frame[0]);
+		if(len < (headerSize+checkSize))
+			return 0;
+		dataSize = (len-headerSize-checkSize);
+		cmdStatus = frame[((destination != 0) ? 2 : 1)];
+	} else {
+		// handshake messages are not queued, the peer offers again
+		if(len < MCHEADERSIZE || frame[0] != _version || frame[1] == MCTYPELINK)
+			return 0;
+		dataSize = getSizeFrom(frame);
+		if(len < (headerSize+dataSize+checkSize))
+			return 0;
+		cmdStatus = frame[2];
+	}
+
+	uint32_t checksum = checksumUpdate(_check, checksumStart(_check), frame, (headerSize+dataSize));
+	if(checksumFinish(_check, checksum) != readChecksum(&frame[(headerSize+dataSize)], checkSize))
+		return 0;
+
+	// the peer may acknowledge the own message inside its message
+	if((frame[0] & MCCOMPACT) && _ackFrame && !(frame[0] & MCCOMPACTADDRESS))
+		_recvAck = frame[(headerSize-1)];
+
+	slot[2] = headerSize;
+	setSlotSize(slot, (headerSize+dataSize+checkSize));
+	// like receive(): only a message with the state flag reaches the application
+	if(getStateFromCommandStatus(cmdStatus))
+		return MCQUEUEREADY;
+	return MCQUEUENACK;
+}
+
+// trace
+#ifdef MCTRACE
+void MessageComLite::traceStart(uint8_t stage) {
+	_traceStart[stage] = micros();
+	bitSet(_traceRunning, stage);
+}
+void MessageComLite::traceStop(uint8_t stage) {
+	// a stop without its start is not measured
+	if(!bitRead(_traceRunning, stage))
+		return;
+	bitClear(_traceRunning, stage);
+
+	unsigned long duration = (micros()-_traceStart[stage]);
+	_traceSum[stage] += duration;
+
+	// bucket 0: < 16us, every next bucket is 4 times wider, the last one takes the rest
+	uint8_t bucket = 0;
+	for(unsigned long limit=(duration >> 4); limit > 0 && bucket < (MCTRACEBUCKETS-1); limit >>= 2)
+		bucket++;
+	// the counter stays at its maximum instead of overflowing
+	if(_traceHist[stage][bucket] < 0xFFFF)
+		_traceHist[stage][bucket]++;
+}
+#endif
+
+// template
+void MessageComLite::markDirty(MCSize pos) {
+	// pos counts from the frame start
+	if(pos < _dirtyFrom)
+		_dirtyFrom = pos;
+	if(pos > _dirtyTo)
+		_dirtyTo = pos;
+}
+boolean MessageComLite::updateDataBytes(uint8_t index, uint8_t *bytes, uint8_t size) {
+	// overwrite a field of the same size and remember the changed bytes
+	MCSize len;
+	int start, stop;
+	getPositionsOfIndexFromData(index, len, start, stop);
+	if((stop-start) != size)
+		return 0;
+
+	for(uint8_t i=0; i<size; i++) {
+		if(_data[(start+i)] != bytes[i]) {
+			_data[(start+i)] = bytes[i];
+			markDirty((_headerSize+start+i));
+		}
+	}
+	return 1;
+}
+void MessageComLite::updateTemplate() {
+	// nothing changed: the cached message is still right
+	if(_dirtyFrom > _dirtyTo)
+		return;
+
+	uint8_t *frame = &_msg[_frameStart];
+	MCSize end = (_headerSize+_dataSize);
+	MCSize total = (_size+_paritySize);
+
+	// checksum: resume from the cached state in front of the first changed byte
+	// the bytes in front of it are unchanged, so the state can be cached again right there
+	uint32_t crc = checksumStart(_msgCheck);
+	MCSize i = 0;
+	if(_dirtyFrom >= _crcPos) {
+		crc = _crcCache;
+		i = _crcPos;
+	}
+	crc = checksumUpdate(_msgCheck, crc, &frame[i], (_dirtyFrom-i));
+	_crcCache = crc;
+	_crcPos = _dirtyFrom;
+	crc = checksumUpdate(_msgCheck, crc, &frame[_dirtyFrom], (end-_dirtyFrom));
+	_checksum = checksumFinish(_msgCheck, crc);
+	getCrcLH((uint16_t) _checksum);
+	writeChecksum(&frame[end]);
+
+	// base64: encode the groups of the changed bytes and of the checksum again
+	for(MCSize g=(_dirtyFrom/3); g<=(_dirtyTo/3); g++)
+		base64EncodeGroup(&_buffer[(1+(g*4))], &frame[(g*3)], (total-(g*3)));
+	for(MCSize g=(end/3); g<=((end+_checkSize-1)/3); g++)
+		base64EncodeGroup(&_buffer[(1+(g*4))], &frame[(g*3)], (total-(g*3)));
+	// the parity depends on every byte, so all of it is encoded again
+	if(_paritySize > 0) {
+		fecEncode(frame, _size);
+		for(MCSize g=(_size/3); g<=((total-1)/3); g++)
+			base64EncodeGroup(&_buffer[(1+(g*4))], &frame[(g*3)], (total-(g*3)));
+	}
+
+	_dirtyFrom = MCNOPOS;
+	_dirtyTo = 0;
+}
+
+// non-blocking
+boolean MessageComLite::parseByte(uint8_t value) {
+	// collect a message byte by byte, returns 1 if a message was read
+	if(value == _startDelimiter) {
+		// every start begins a new message
+		memset(_buffer, 0, _bufferMaxSize);
+		MCTRACESTART(MCTRACERECEIVE);
+		_recvPos = 0;
+		_buffer[_recvPos++] = value;
+		return 0;
+	}
+	// outside of a message
+	if(_recvPos == 0)
+		return 0;
+
+	if(value == _stopDelimiter) {
+		MCTRACESTOP(MCTRACERECEIVE);
+		_buffer[_recvPos] = value;
+		_recvPos = 0;
+		if(readMsg(_buffer))
+			return 1;
+		// a garbled message: maybe the link degraded
+		if(!_foreign)
+			linkFailed();
+	} else if(byteInFrame(value)) {
+		// too long for the buffer: drop it
+		if(_recvPos >= (_bufferMaxSize-1))
+			_recvPos = 0;
+		else
+			_buffer[_recvPos++] = value;
+	}
+	return 0;
+}
+
+// dispatch
+int MessageComLite::findHandler(uint8_t type, uint8_t taskValue) {
+	// binary search in the sorted handler table
+	int low = 0, high = (_handlerCount-1);
+	while(low <= high) {
+		int mid = ((low+high)/2);
+		const MCHandlerEntry *entry = &_handlers[mid];
+		if(entry->type == type && entry->taskValue == taskValue)
+			return mid;
+		if(entry->type < type || (entry->type == type && entry->taskValue < taskValue))
+			low = (mid+1);
+		else
+			high = (mid-1);
+	}
+	return -1;
+}
+
+// capture
+void MessageComLite::captureByte(uint8_t direction, uint8_t value) {
+	// a new record starts with a change of direction or a full chunk
+	if(_captureSize > 0 && (direction != _captureDirection || _captureSize >= MCCAPTURECHUNK))
+		captureFlush();
+
+	if(_captureSize == 0) {
+		_captureDirection = direction;
+		_captureTime = millis();
+	}
+	_captureChunk[_captureSize++] = value;
+}
+void MessageComLite::captureFlush() {
+	if(_capture == NULL || _captureSize == 0)
+		return;
+
+	// record: direction | timestamp (4 byte, high byte first) | length | bytes
+	_capture->write(_captureDirection);
+	_capture->write((uint8_t) (_captureTime >> 24));
+	_capture->write((uint8_t) (_captureTime >> 16));
+	_capture->write((uint8_t) (_captureTime >> 8));
+	_capture->write((uint8_t) _captureTime);
+	_capture->write(_captureSize);
+	_capture->write(_captureChunk, _captureSize);
+	_captureSize = 0;
+}
+
+
+uint8_t MessageComLite::compactHeaderSize(uint8_t flags) {
+	// type and flags [| destination] | commandStatus [| messageNumber | totalQuantity] [| acknowledgement]
+	// on a bus the sender is unknown, so a message with destination carries no acknowledgement
+	uint8_t size = 2;
+	if(flags & MCCOMPACTADDRESS)
+		size++;
+	if(flags & MCCOMPACTFRAGMENTS)
+		size += 2;
+	if(_ackFrame && !(flags & MCCOMPACTADDRESS))
+		size++;
+	return size;
+}
+
+// addressing
+uint8_t MessageComLite::getDestinationFrom(uint8_t *frame) {
+	// only a compact header carries a destination, 0: the message is for every node
+	if((frame[0] & MCCOMPACT) && (frame[0] & MCCOMPACTADDRESS))
+		return frame[1];
+	return 0;
+}
+MCSize MessageComLite::getSizeFrom(uint8_t *header) {
+	// the size in a regular header, with large frames high byte first
+#ifdef MCLARGEFRAMES
+	return (((MCSize) header[5] << 8) | header[6]);
+#else
+	return header[5];
+#endif
+}
+boolean MessageComLite::addressedToMe(uint8_t destination) {
+	// a node without address takes every message
+	if(_address == 0 || destination == 0 || destination == MCBROADCAST)
+		return 1;
+	return (destination == _address || (_group != 0 && destination == _group));
+}
+
+// base64
+void MessageComLite::base64EncodeGroup(uint8_t *output, uint8_t *input, MCSize len) {
+	// encode 1 to 3 bytes into 4 chars, missing bytes are padded with '='
+	uint8_t b0 = input[0];
+	uint8_t b1 = (len > 1) ? input[1] : 0;
+	uint8_t b2 = (len > 2) ? input[2] : 0;
+
+	output[0] = pgm_read_byte(&MCBASE64ALPHABET[(b0 >> 2)]);
+	output[1] = pgm_read_byte(&MCBASE64ALPHABET[(((b0 & 0x03) << 4) | (b1 >> 4))]);
+	output[2] = (len > 1) ? pgm_read_byte(&MCBASE64ALPHABET[(((b1 & 0x0F) << 2) | (b2 >> 6))]) : '=';
+	output[3] = (len > 2) ? pgm_read_byte(&MCBASE64ALPHABET[(b2 & 0x3F)]) : '=';
+}
+uint8_t MessageComLite::base64DecodeQuad(uint8_t *output, uint8_t *input) {
+	// decode 4 chars into 1 to 3 bytes, returns 0 for chars outside the alphabet
+	uint8_t len = 3;
+	if(input[3] == '=')
+		len = (input[2] == '=') ? 1 : 2;
+
+	uint8_t v[4];
+	for(uint8_t i=0; i<=len; i++) {
+		uint8_t c = (uint8_t) (input[i]-43);
+		if(c >= 80 || (v[i] = pgm_read_byte(&MCBASE64LOOKUP[c])) > 63)
+			return 0;
+	}
+
+	output[0] = ((v[0] << 2) | (v[1] >> 4));
+	if(len > 1)
+		output[1] = ((v[1] << 4) | (v[2] >> 2));
+	if(len > 2)
+		output[2] = ((v[2] << 6) | v[3]);
+	return len;
+}
+MCSize MessageComLite::base64Encode(uint8_t *output, uint8_t *input, MCSize len) {
+	MCSize outLen = 0;
+	for(MCSize i=0; i<len; i+=3) {
+		base64EncodeGroup(&output[outLen], &input[i], (len-i));
+		outLen += 4;
+	}
+	return outLen;
+}
+MCSize MessageComLite::base64Decode(uint8_t *output, uint8_t *input, MCSize len) {
+	// all chars of a quad are read before its bytes are written,
+	// so output may be the same array as input
+	MCSize outLen = 0;
+	for(MCSize i=0; (i+4)<=len; i+=4) {
+		uint8_t quadLen = base64DecodeQuad(&output[outLen], &input[i]);
+		outLen += quadLen;
+		// invalid char or padding: the message ends here
+		if(quadLen < 3)
+			break;
+	}
+	return outLen;
+}
+
+// checksum engines
+uint8_t MessageComLite::checkOf(uint8_t features) {
+	// the strongest checksum of the features, CRC-16 without one
+	if(features & MCFEATCRC32C)
+		return MCCHECKCRC32C;
+	if(features & MCFEATFLETCHER16)
+		return MCCHECKFLETCHER16;
+	return MCCHECKCRC16;
+}
+uint8_t MessageComLite::checkSizeOf(uint8_t engine) {
+	if(engine == MCCHECKCRC32C)
+		return 4;
+	return 2;
+}
+void MessageComLite::useCheck(uint8_t engine) {
+	// the checksum of the message in _msg
+	_msgCheck = engine;
+	_checkSize = checkSizeOf(engine);
+}
+uint32_t MessageComLite::checksumStart(uint8_t engine) {
+	if(engine == MCCHECKCRC16)
+		return 0xffff;
+	if(engine == MCCHECKCRC32C)
+		return 0xffffffff;
+	return 0;
+}
+uint32_t MessageComLite::checksumUpdate(uint8_t engine, uint32_t state, uint8_t *data, MCSize len) {
+	// the state can be cached between two calls (see updateTemplate)
+	if(engine == MCCHECKCRC32C)
+		return crc32cUpdate(state, data, len);
+
+	if(engine == MCCHECKFLETCHER16) {
+		// both sums modulo 255, a subtraction is cheaper than the division on an AVR
+		uint16_t sum1 = (state & 0xFF), sum2 = (state >> 8);
+		for(MCSize i=0; i<len; i++) {
+			sum1 += data[i];
+			if(sum1 >= 255)
+				sum1 -= 255;
+			sum2 += sum1;
+			if(sum2 >= 255)
+				sum2 -= 255;
+		}
+		return (((uint32_t) sum2 << 8) | sum1);
+	}
+
+	uint16_t crc = (uint16_t) state;
+	for(MCSize i=0; i<len; i++)
+		crc = _crc_ccitt_update(crc, data[i]);
+	return crc;
+}
+uint32_t MessageComLite::checksumFinish(uint8_t engine, uint32_t state) {
+	if(engine == MCCHECKCRC32C)
+		return ~state;
+	return state;
+}
+uint32_t MessageComLite::crc32cUpdate(uint32_t crc, uint8_t *data, MCSize len) {
+#if defined(__SSE4_2__) || defined(__ARM_FEATURE_CRC32)
+	// 4 bytes per instruction, the CRC is reflected, so the bytes go in little endian
+	for(; len >= 4; len-=4, data+=4) {
+		uint32_t word = ((uint32_t) data[0] | ((uint32_t) data[1] << 8) |
+			((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24));
+	#if defined(__SSE4_2__)
+		crc = _mm_crc32_u32(crc, word);
+	#else
+		crc = __crc32cw(crc, word);
+	#endif
+	}
+	for(; len > 0; len--, data++) {
+	#if defined(__SSE4_2__)
+		crc = _mm_crc32_u8(crc, *data);
+	#else
+		crc = __crc32cb(crc, *data);
+	#endif
+	}
+#else
+	// two nibbles per byte, the table takes 64 bytes of flash
+	for(MCSize i=0; i<len; i++) {
+		crc ^= data[i];
+		crc = ((crc >> 4) ^ pgm_read_dword(&MCCRC32CNIBBLE[(crc & 0x0F)]));
+		crc = ((crc >> 4) ^ pgm_read_dword(&MCCRC32CNIBBLE[(crc & 0x0F)]));
+	}
+#endif
+	return crc;
+}
+uint32_t MessageComLite::readChecksum(uint8_t *pos, uint8_t size) {
+	// the checksum behind the data, high byte first
+	uint32_t checksum = 0;
+	for(uint8_t i=0; i<size; i++)
+		checksum = ((checksum << 8) | pos[i]);
+	return checksum;
+}
+void MessageComLite::writeChecksum(uint8_t *pos) {
+	// _checksum behind the data, high byte first
+	for(uint8_t i=0; i<_checkSize; i++)
+		pos[i] = (uint8_t) (_checksum >> ((_checkSize-1-i)*8));
+}
+
+// forward error correction
+// Reed-Solomon over GF(256): every block of up to (255-MCFECPARITY) bytes of the frame gets MCFECPARITY parity bytes,
+// all parity follows the checksum, so header, data and checksum stay where they are
+uint8_t MessageComLite::fecMul(uint8_t a, uint8_t b) {
+	if(a == 0 || b == 0)
+		return 0;
+	uint16_t l = (pgm_read_byte(&MCFECLOG[a])+pgm_read_byte(&MCFECLOG[b]));
+	if(l >= 255)
+		l -= 255;
+	return pgm_read_byte(&MCFECEXP[l]);
+}
+uint8_t MessageComLite::fecInv(uint8_t a) {
+	// a must not be 0
+	return pgm_read_byte(&MCFECEXP[(255-pgm_read_byte(&MCFECLOG[a]))]);
+}
+MCSize MessageComLite::fecParityOf(MCSize len) {
+	// parity bytes of a frame of len bytes
+	return (((len+(254-MCFECPARITY))/(255-MCFECPARITY))*MCFECPARITY);
+}
+MCSize MessageComLite::fecEncode(uint8_t *frame, MCSize len) {
+	// generator polynomial (x-1)(x-alpha)...(x-alpha^(MCFECPARITY-1)), highest coefficient first
+	uint8_t gen[(MCFECPARITY+1)];
+	memset(gen, 0, sizeof(gen));
+	gen[0] = 1;
+	for(uint8_t i=0; i<MCFECPARITY; i++) {
+		uint8_t root = pgm_read_byte(&MCFECEXP[i]);
+		for(uint8_t j=(i+1); j>0; j--)
+			gen[j] ^= fecMul(gen[(j-1)], root);
+	}
+
+	// the parity is the remainder of the block divided by the generator
+	MCSize parityPos = len;
+	for(MCSize start=0; start<len; start+=(255-MCFECPARITY)) {
+		uint8_t *parity = &frame[parityPos];
+		memset(parity, 0, MCFECPARITY);
+		MCSize blockLen = min((MCSize) (len-start), (MCSize) (255-MCFECPARITY));
+		for(MCSize i=0; i<blockLen; i++) {
+			uint8_t feedback = (frame[(start+i)]^parity[0]);
+			for(uint8_t j=0; j<(MCFECPARITY-1); j++)
+				parity[j] = (parity[(j+1)]^fecMul(feedback, gen[(j+1)]));
+			parity[(MCFECPARITY-1)] = fecMul(feedback, gen[MCFECPARITY]);
+		}
+		parityPos += MCFECPARITY;
+	}
+	return (parityPos-len);
+}
+boolean MessageComLite::fecCorrectBlock(uint8_t *block, MCSize blockLen, uint8_t *parity) {
+	// correct up to MCFECPARITY/2 wrong bytes of block and parity, returns 0 if there are more
+	MCSize n = (blockLen+MCFECPARITY);
+
+	// syndromes: the codeword at the roots of the generator, all 0 without errors
+	uint8_t syndrome[MCFECPARITY];
+	boolean errors = 0;
+	for(uint8_t j=0; j<MCFECPARITY; j++) {
+		uint8_t root = pgm_read_byte(&MCFECEXP[j]);
+		uint8_t value = 0;
+		for(MCSize i=0; i<n; i++)
+			value = (fecMul(value, root)^((i < blockLen) ? block[i] : parity[(i-blockLen)]));
+		syndrome[j] = value;
+		if(value != 0)
+			errors = 1;
+	}
+	if(!errors)
+		return 1;
+
+	// Berlekamp-Massey: the error locator polynomial, lowest coefficient first
+	uint8_t locator[(MCFECPARITY+1)], last[(MCFECPARITY+1)], saved[(MCFECPARITY+1)];
+	memset(locator, 0, sizeof(locator));
+	memset(last, 0, sizeof(last));
+	locator[0] = 1;
+	last[0] = 1;
+	uint8_t count = 0, shift = 1, lastDiscrepancy = 1;
+	for(uint8_t r=0; r<MCFECPARITY; r++) {
+		uint8_t discrepancy = syndrome[r];
+		for(uint8_t i=1; i<=count; i++)
+			discrepancy ^= fecMul(locator[i], syndrome[(r-i)]);
+		if(discrepancy == 0) {
+			shift++;
+			continue;
+		}
+		uint8_t factor = fecMul(discrepancy, fecInv(lastDiscrepancy));
+		memcpy(saved, locator, sizeof(locator));
+		for(uint8_t i=shift; i<=MCFECPARITY; i++)
+			locator[i] ^= fecMul(factor, last[(i-shift)]);
+		if((2*count) <= r) {
+			count = (r+1-count);
+			memcpy(last, saved, sizeof(last));
+			lastDiscrepancy = discrepancy;
+			shift = 1;
+		} else {
+			shift++;
+		}
+	}
+	if(count > (MCFECPARITY/2))
+		return 0;
+
+	// error evaluator polynomial: syndromes times locator, up to x^(MCFECPARITY-1)
+	uint8_t evaluator[MCFECPARITY];
+	for(uint8_t k=0; k<MCFECPARITY; k++) {
+		evaluator[k] = 0;
+		for(uint8_t i=0; i<=k && i<=count; i++)
+			evaluator[k] ^= fecMul(syndrome[(k-i)], locator[i]);
+	}
+
+	// Chien search: the byte i is wrong if the locator is 0 at alpha^-(n-1-i),
+	// Forney: its error value is X*evaluator(1/X)/locator'(1/X) with X = alpha^(n-1-i)
+	// the errors are only corrected once all of them are found
+	MCSize errorPos[(MCFECPARITY/2)];
+	uint8_t errorValue[(MCFECPARITY/2)];
+	uint8_t found = 0;
+	for(MCSize i=0; i<n; i++) {
+		uint8_t power = (uint8_t) ((n-1-i) % 255);
+		uint8_t x = pgm_read_byte(&MCFECEXP[power]);
+		uint8_t xInv = pgm_read_byte(&MCFECEXP[(255-power)]);
+
+		uint8_t value = 0;
+		for(uint8_t k=(count+1); k>0; k--)
+			value = (fecMul(value, xInv)^locator[(k-1)]);
+		if(value != 0)
+			continue;
+
+		uint8_t numerator = 0, denominator = 0;
+		for(uint8_t k=MCFECPARITY; k>0; k--)
+			numerator = (fecMul(numerator, xInv)^evaluator[(k-1)]);
+		// the derivative keeps the odd terms only
+		for(uint8_t k=((count+1)/2); k>0; k--)
+			denominator = (fecMul(denominator, fecMul(xInv, xInv))^locator[((2*k)-1)]);
+		if(denominator == 0 || found >= count)
+			return 0;
+
+		errorPos[found] = i;
+		errorValue[found++] = fecMul(fecMul(x, numerator), fecInv(denominator));
+	}
+	// fewer roots than errors: more errors than the parity can correct
+	if(found != count)
+		return 0;
+
+	for(uint8_t k=0; k<found; k++) {
+		if(errorPos[k] < blockLen)
+			block[errorPos[k]] ^= errorValue[k];
+		else
+			parity[(errorPos[k]-blockLen)] ^= errorValue[k];
+	}
+	return 1;
+}
+MCSize MessageComLite::fecCorrect(uint8_t *encoded, MCSize encodedLen) {
+	// correct a received frame with parity in place and encode it again without the parity,
+	// returns the new encoded length or encodedLen if it can not be corrected
+	if(encodedLen < 4 || (encodedLen % 4) != 0)
+		return encodedLen;
+
+	// the number of blocks follows from the length, a block has at most 255 bytes,
+	// a length that does not fit to the parity is rejected before the decode
+	MCSize len = ((encodedLen/4)*3);
+	if(encoded[(encodedLen-1)] == '=')
+		len--;
+	if(encoded[(encodedLen-2)] == '=')
+		len--;
+	MCSize blocks = ((len+254)/255);
+	if(len <= (blocks*MCFECPARITY))
+		return encodedLen;
+	MCSize frameLen = (len-(blocks*MCFECPARITY));
+	if(fecParityOf(frameLen) != (len-frameLen))
+		return encodedLen;
+
+	// decode in place, a char outside the alphabet is just one more wrong byte
+	for(MCSize i=0, o=0; i<encodedLen; i+=4) {
+		uint8_t v[4];
+		for(uint8_t k=0; k<4; k++) {
+			uint8_t c = (uint8_t) (encoded[(i+k)]-43);
+			v[k] = (c < 80) ? pgm_read_byte(&MCBASE64LOOKUP[c]) : 0xFF;
+			if(v[k] > 63)
+				v[k] = 0;
+		}
+		encoded[o++] = ((v[0] << 2) | (v[1] >> 4));
+		if(o < len)
+			encoded[o++] = ((v[1] << 4) | (v[2] >> 2));
+		if(o < len)
+			encoded[o++] = ((v[2] << 6) | v[3]);
+	}
+
+	boolean corrected = 1;
+	for(MCSize start=0, b=0; corrected && start<frameLen; start+=(255-MCFECPARITY), b++) {
+		MCSize blockLen = min((MCSize) (frameLen-start), (MCSize) (255-MCFECPARITY));
+		corrected = fecCorrectBlock(&encoded[start], blockLen, &encoded[(frameLen+(b*MCFECPARITY))]);
+	}
+	if(!corrected)
+		frameLen = len;
+
+	// encode again from the last group on, the chars of a group never overwrite bytes of the groups in front of it
+	MCSize groups = ((frameLen+2)/3);
+	for(MCSize g=groups; g>0; g--)
+		base64EncodeGroup(&encoded[((g-1)*4)], &encoded[((g-1)*3)], (frameLen-((g-1)*3)));
+	return (groups*4);
+}
+
+
+// message
+MCMessage::MCMessage(uint8_t *buffer, MCSize buffer_maxSize, uint8_t *msg, MCSize maxSize) {
 	// use the adress of the user defined array for the message
 	_bufferMaxSize = buffer_maxSize;
 	_buffer = buffer;
 
 	_maxSize = maxSize;
 	_msg = msg;
+	_data = ((_msg != NULL) ? &_msg[MCHEADERSIZE] : NULL);
+
+	// an empty message, like after clear()
+	_size = 0;
+	_bufferSize = 0;
+	_version = MCVERSION;
+	_type = 0;
+	_commandStatus = 0;
+	_messageNumber = 1;
+	_totalQuantity = 1;
+	_dataSize = 0;
+	_dataCount = 0;
+	_nextData = 0;
+	_headerSize = MCHEADERSIZE;
+	_frameStart = 0;
+	_destination = 0;
+	_recvDestination = 0;
+	_foreign = 0;
+	_recvPos = 0;
+	_templateValid = 0;
+	_dirtyFrom = MCNOPOS;
+	_dirtyTo = 0;
+	_crcPos = 0;
+	_crcCache = 0;
+	// CRC-16 until clear() takes the engine of the link
+	_msgCheck = MCCHECKCRC16;
+	_checkSize = 2;
+	_checksum = 0;
+	_csH = 0;
+	_csL = 0;
+	_paritySize = 0;
+}
+MCMessage::MCMessage() : MCMessage(NULL, 0, NULL, 0) {
+}
+MCMessage::MCMessage(MCMessage &&message) {
+	*this = static_cast<MCMessage&&>(message);
+}
+MCMessage& MCMessage::operator=(MCMessage &&message) {
+	if(this == &message)
+		return *this;
+	_buffer = message._buffer;
+	_msg = message._msg;
+	_data = message._data;
+	_bufferMaxSize = message._bufferMaxSize;
+	_maxSize = message._maxSize;
+	_size = message._size;
+	_bufferSize = message._bufferSize;
+	_version = message._version;
+	_type = message._type;
+	_commandStatus = message._commandStatus;
+	_messageNumber = message._messageNumber;
+	_totalQuantity = message._totalQuantity;
+	_dataSize = message._dataSize;
+	_dataCount = message._dataCount;
+	_nextData = message._nextData;
+	_headerSize = message._headerSize;
+	_frameStart = message._frameStart;
+	_destination = message._destination;
+	_recvDestination = message._recvDestination;
+	_foreign = message._foreign;
+	_recvPos = message._recvPos;
+	_templateValid = message._templateValid;
+	_dirtyFrom = message._dirtyFrom;
+	_dirtyTo = message._dirtyTo;
+	_crcPos = message._crcPos;
+	_crcCache = message._crcCache;
+	_msgCheck = message._msgCheck;
+	_checkSize = message._checkSize;
+	_checksum = message._checksum;
+	_csH = message._csH;
+	_csL = message._csL;
+	_paritySize = message._paritySize;
+
+	// the arrays belong to this message now
+	message._buffer = NULL;
+	message._msg = NULL;
+	message._data = NULL;
+	message._bufferMaxSize = 0;
+	message._maxSize = 0;
+	message._size = 0;
+	message._bufferSize = 0;
+	message._dataSize = 0;
+	message._dataCount = 0;
+	message._recvPos = 0;
+	message._templateValid = 0;
+	return *this;
+}
 
+// public
+MessageComLite::MessageComLite(HardwareSerial &hwSerial, uint8_t *buffer, MCSize buffer_maxSize, uint8_t *msg, MCSize maxSize)
+	: MCMessage(buffer, buffer_maxSize, msg, maxSize) {
 	_startDelimiter = '#';
 	_stopDelimiter = ';';
 	_delimiter = '|';
@@ -123,16 +1198,63 @@ MessageComLite::MessageComLite(HardwareSerial &hwSerial, uint8_t *buffer, uint8_
 	_Serial = &hwSerial;
 	_swSerial = NULL;
 
+	_capture = NULL;
+	_captureSize = 0;
+
+	_queue = NULL;
+	_queueSlots = 0;
+	_queueOrder = 0;
+
+	_handlers = NULL;
+	_handlerCount = 0;
+
+	_compact = 0;
+	_check = MCCHECKCRC16;
+	_fec = 0;
+	_ackFrame = 0;
+	_ackDue = 0;
+	_ackDueSince = 0;
+	_ackValue = 0;
+	_recvAck = 0;
+	_sendAck = 0;
+	_echoLine = 0;
+	_echoAcks = 0;
+	_echoNacks = 0;
+
+	_address = 0;
+	_group = 0;
+
+	_baseBaud = 0;
+	_maxBaud = 0;
+	_baud = 0;
+	_features = MCFEATCOMPACT;
+	_linkFeatures = 0;
+	_linkMaxSize = maxSize;
+	_failCount = 0;
+	_lastLife = 0;
+	_awaitLife = 0;
+
+	_sendState = MCIDLE;
+	_sendSilent = 0;
+	_echoFrame = NULL;
+	_echoSize = 0;
+	_echoPos = 0;
+
+	_template = 0;
+
+	_rxQueue = NULL;
+	_rxSlots = 0;
+	_rxSlot = 0xFF;
+	_rxOrder = 0;
+
+#ifdef MCTRACE
+	clearTrace();
+#endif
+
 	clear();
 }
-MessageComLite::MessageComLite(SoftwareSerial &swSerial, uint8_t *buffer, uint8_t buffer_maxSize, uint8_t *msg, uint8_t maxSize) {
-	// use the adress of the user defined array for the message
-	_bufferMaxSize = buffer_maxSize;
-	_buffer = buffer;
-
-	_maxSize = maxSize;
-	_msg = msg;
-
+MessageComLite::MessageComLite(SoftwareSerial &swSerial, uint8_t *buffer, MCSize buffer_maxSize, uint8_t *msg, MCSize maxSize)
+	: MCMessage(buffer, buffer_maxSize, msg, maxSize) {
 	_startDelimiter = '#';
 	_stopDelimiter = ';';
 	_delimiter = '|';
@@ -142,27 +1264,558 @@ MessageComLite::MessageComLite(SoftwareSerial &swSerial, uint8_t *buffer, uint8_
 	_Serial = NULL;
 	_swSerial = &swSerial;
 
+	_capture = NULL;
+	_captureSize = 0;
+
+	_queue = NULL;
+	_queueSlots = 0;
+	_queueOrder = 0;
+
+	_handlers = NULL;
+	_handlerCount = 0;
+
+	_compact = 0;
+	_check = MCCHECKCRC16;
+	_fec = 0;
+	_ackFrame = 0;
+	_ackDue = 0;
+	_ackDueSince = 0;
+	_ackValue = 0;
+	_recvAck = 0;
+	_sendAck = 0;
+	_echoLine = 0;
+	_echoAcks = 0;
+	_echoNacks = 0;
+
+	_address = 0;
+	_group = 0;
+
+	_baseBaud = 0;
+	_maxBaud = 0;
+	_baud = 0;
+	_features = MCFEATCOMPACT;
+	_linkFeatures = 0;
+	_linkMaxSize = maxSize;
+	_failCount = 0;
+	_lastLife = 0;
+	_awaitLife = 0;
+
+	_sendState = MCIDLE;
+	_sendSilent = 0;
+	_echoFrame = NULL;
+	_echoSize = 0;
+	_echoPos = 0;
+
+	_template = 0;
+
+	_rxQueue = NULL;
+	_rxSlots = 0;
+	_rxSlot = 0xFF;
+	_rxOrder = 0;
+
+#ifdef MCTRACE
+	clearTrace();
+#endif
+
+	clear();
+}
+
+// capture
+void MessageComLite::setCapture(Print &capture) {
+	captureFlush();
+	_capture = &capture;
+	_captureSize = 0;
+
+	// file header: magic and format version
+	_capture->write((const uint8_t*) MCCAPTUREMAGIC, 4);
+}
+void MessageComLite::stopCapture() {
+	captureFlush();
+	_capture = NULL;
+}
+
+// queue
+void MessageComLite::setQueue(uint8_t *queue, uint8_t slots) {
+	// the user defined array must hold MCQUEUESIZE(slots, buffer_maxSize) bytes
+	_queue = queue;
+	_queueSlots = slots;
+	_queueOrder = 0;
+
+	// priority 0 marks a free slot
+	for(uint8_t i=0; i<_queueSlots; i++)
+		getQueueSlot(_queue, i)[0] = 0;
+}
+boolean MessageComLite::enqueue(uint8_t priority) {
+	// queue the message created by createMessage()
+	if(_queue == NULL || _bufferSize == 0 || priority == 0)
+		return 0;
+	// a queued message carries no acknowledgement, not even the one of an earlier send
+	if(_ackFrame && (_msg[_frameStart] & MCCOMPACT) && !(_msg[_frameStart] & MCCOMPACTADDRESS))
+		carryAck(0);
+
+	for(uint8_t i=0; i<_queueSlots; i++) {
+		uint8_t *slot = getQueueSlot(_queue, i);
+		if(slot[0] == 0) {
+			// slot: priority | order | tries | acknowledgement | size | buffer
+			slot[0] = priority;
+			slot[1] = _queueOrder++;
+			slot[2] = 0;
+			slot[3] = getFrameAck();
+			setSlotSize(slot, _bufferSize);
+			memcpy(&slot[MCQUEUEHEADER], _buffer, _bufferSize);
+			return 1;
+		}
+	}
+	// queue is full
+	return 0;
+}
+uint8_t MessageComLite::getQueueCount() {
+	uint8_t cnt = 0;
+	for(uint8_t i=0; i<_queueSlots; i++)
+		if(getQueueSlot(_queue, i)[0] != 0)
+			cnt++;
+	return cnt;
+}
+boolean MessageComLite::sendQueued() {
+	// send the most urgent queued message, the oldest one of its priority first
+	int next = -1;
+	uint8_t *best = NULL;
+	for(uint8_t i=0; i<_queueSlots; i++) {
+		uint8_t *slot = getQueueSlot(_queue, i);
+		if(slot[0] == 0)
+			continue;
+		// the age survives the overflow of _queueOrder
+		if(best == NULL || slot[0] < best[0] || (slot[0] == best[0] &&
+			(uint8_t) (_queueOrder-slot[1]) > (uint8_t) (_queueOrder-best[1]))) {
+			best = slot;
+			next = i;
+		}
+	}
+	if(next < 0)
+		return 0;
+
+	// the slot holds the encoded message, the first quad tells the destination
+	uint8_t header[3];
+	boolean silent = (base64DecodeQuad(header, &best[(MCQUEUEHEADER+1)]) == 3 &&
+		(getDestinationFrom(header) & MCGROUP));
+	MCSize sentBytes = sndFrom(&best[MCQUEUEHEADER], getSlotSize(best));
+	_sendAck = best[3];
+	// nobody answers a message to a group or to all nodes
+	if(silent) {
+		waitEcho(sentBytes);
+		best[0] = 0;
+		return 1;
+	}
+	awaitLife();
+	delay(MCTIMER);
+	if(receiveAck(sentBytes)) {
+		best[0] = 0;
+		_lastLife = millis();
+		_awaitLife = 0;
+		return 1;
+	}
+	// give up after MCMAXTRY tries, so a dead message can not block the queue
+	if(++best[2] >= MCMAXTRY)
+		best[0] = 0;
+	return 0;
+}
+
+// receive queue
+void MessageComLite::setRxQueue(uint8_t *queue, uint8_t slots) {
+	// the user defined array must hold MCQUEUESIZE(slots, buffer_maxSize) bytes
+	_rxQueue = queue;
+	_rxSlots = slots;
+	_rxSlot = 0xFF;
+	_rxOrder = 0;
+
+	for(uint8_t i=0; i<_rxSlots; i++)
+		getQueueSlot(_rxQueue, i)[0] = 0;
+}
+boolean MessageComLite::recvQueued() {
+	// read the oldest message received while waiting for an acknowledgement
+	uint8_t *best = NULL;
+	for(uint8_t i=0; i<_rxSlots; i++) {
+		uint8_t *slot = getQueueSlot(_rxQueue, i);
+		if(slot[0] == MCQUEUEREADY &&
+			(best == NULL || (uint8_t) (_rxOrder-slot[1]) > (uint8_t) (_rxOrder-best[1])))
+			best = slot;
+	}
+	if(best == NULL)
+		return 0;
+	best[0] = 0;
+
+	// the header ends in front of _data like for every received message
+	uint8_t headerSize = best[2];
+	MCSize size = getSlotSize(best);
+	if(size > (_maxSize-(MCHEADERSIZE-headerSize)))
+		return 0;
+
+	_templateValid = 0;
+	_headerSize = headerSize;
+	_frameStart = (MCHEADERSIZE-_headerSize);
+	useCheck(_check);
+	memcpy(&_msg[_frameStart], &best[MCQUEUEHEADER], size);
+	_dataSize = (size-_headerSize-_checkSize);
+	_size = size;
+	gatherInfoFromMessage();
+	return 1;
+}
+
+// dispatch
+void MessageComLite::setHandlers(const MCHandlerEntry *handlers, uint8_t count) {
+	_handlers = handlers;
+	_handlerCount = count;
+}
+boolean MessageComLite::dispatch() {
+	// call the handler of the received message
+	if(_handlers == NULL)
+		return 0;
+
+	int entry = findHandler(_type, getTaskValue());
+	// no handler for the task: look for the one of the whole type
+	if(entry < 0)
+		entry = findHandler(_type, MCANYTASK);
+	if(entry < 0)
+		return 0;
+
+	_handlers[entry].handler(*this);
+	return 1;
+}
+
+// compact header
+void MessageComLite::setCompactHeader(boolean compact) {
+	_compact = compact;
+}
+
+// checksum engines
+void MessageComLite::setChecksumEngine(uint8_t engine) {
+	// used at once and offered in the handshake, both sides need the same engine
+	_features &= ~(MCFEATFLETCHER16 | MCFEATCRC32C);
+	if(engine == MCCHECKFLETCHER16)
+		_features |= MCFEATFLETCHER16;
+	else if(engine == MCCHECKCRC32C)
+		_features |= MCFEATCRC32C;
+	_check = engine;
+	_templateValid = 0;
+}
+uint8_t MessageComLite::getChecksumEngine() {
+	return _check;
+}
+
+// forward error correction
+void MessageComLite::setErrorCorrection(boolean fec) {
+	// used at once and offered in the handshake, both sides need the same setting
+	if(fec)
+		_features |= MCFEATFEC;
+	else
+		_features &= ~MCFEATFEC;
+	_fec = fec;
+	_templateValid = 0;
+}
+boolean MessageComLite::getErrorCorrection() {
+	return _fec;
+}
+
+// acknowledgement in the frame
+void MessageComLite::setAckInFrame(boolean ackFrame) {
+	// used at once and offered in the handshake, both sides need the same setting
+	if(ackFrame)
+		_features |= MCFEATACKFRAME;
+	else
+		_features &= ~MCFEATACKFRAME;
+	_ackFrame = ackFrame;
+	_templateValid = 0;
+}
+boolean MessageComLite::getAckInFrame() {
+	return _ackFrame;
+}
+void MessageComLite::carryAck(uint8_t value) {
+	// the acknowledgement rides in the last byte of the compact header, 0 takes it out again,
+	// only this byte, the checksum and the parity are encoded again
+	if(_msg[(_frameStart+_headerSize-1)] == value)
+		return;
+	if(!_templateValid) {
+		_dirtyFrom = MCNOPOS;
+		_dirtyTo = 0;
+	}
+	_crcPos = 0;
+	_crcCache = checksumStart(_msgCheck);
+	_msg[(_frameStart+_headerSize-1)] = value;
+	markDirty((_headerSize-1));
+	updateTemplate();
+}
+void MessageComLite::flushAck() {
+	// no message of the own took the due acknowledgement along
+	if(!_ackDue)
+		return;
+	_ackDue = 0;
+	sendAck(1);
+}
+uint8_t MessageComLite::getFrameAck() {
+	// the acknowledgement of the message in _msg: the low byte of its checksum, never 0
+	uint8_t value = _msg[(MCHEADERSIZE+_dataSize+_checkSize-1)];
+	return ((value == 0) ? MCFRAMEACK : value);
+}
+
+// addressing
+void MessageComLite::setAddress(uint8_t address) {
+	// 0: the node takes every message
+	_address = address;
+}
+void MessageComLite::setGroup(uint8_t group) {
+	// the node takes the messages to its group as well, 0: no group
+	if(group != 0)
+		group |= MCGROUP;
+	_group = group;
+}
+void MessageComLite::setDestination(uint8_t destination) {
+	// the destination of the next messages, 0: no address (classic bus of two)
+	_destination = destination;
+}
+uint8_t MessageComLite::getRecvDestination() {
+	return _recvDestination;
+}
+
+// link
+void MessageComLite::setLink(unsigned long baseBaud, unsigned long maxBaud) {
+	// the link starts with baseBaud and falls back to it
+	_baseBaud = baseBaud;
+	_maxBaud = maxBaud;
+	_baud = baseBaud;
+}
+boolean MessageComLite::linkUp() {
+	// offer the own capabilities, the peer answers with its own
+	if(!createLinkMessage(MCLINKOFFER) || !send()) {
+		clear();
+		return 0;
+	}
+
+	MCSize maxSize;
+	uint8_t features;
+	unsigned long maxBaud;
+	if(recv() && getTaskValue() == MCLINKREPLY && readLinkMessage(maxSize, features, maxBaud)) {
+		clear();
+		useLink(maxSize, features, maxBaud);
+		return 1;
+	}
 	clear();
+	return 0;
 }
+void MessageComLite::linkDown() {
+	// back to the settings both sides had before the handshake
+	_linkMaxSize = _maxSize;
+	_linkFeatures = 0;
+	_compact = 0;
+	_check = checkOf(_features);
+	_fec = ((_features & MCFEATFEC) != 0);
+	_ackFrame = ((_features & MCFEATACKFRAME) != 0);
+	_templateValid = 0;
+	_failCount = 0;
+	_awaitLife = 0;
+	setBaud(_baseBaud);
+}
+unsigned long MessageComLite::getBaud() {
+	return _baud;
+}
+MCSize MessageComLite::getLinkMaxSize() {
+	return _linkMaxSize;
+}
+uint8_t MessageComLite::getLinkFeatures() {
+	return _linkFeatures;
+}
+
+// trace
+#ifdef MCTRACE
+void MessageComLite::clearTrace() {
+	memset(_traceHist, 0, sizeof(_traceHist));
+	memset(_traceSum, 0, sizeof(_traceSum));
+	_traceRunning = 0;
+}
+void MessageComLite::dumpTrace(Print &out) {
+	// one line per stage: name, total time in us, counts of the buckets
+	// (< 16us, < 64us, < 256us, < 1ms, < 4ms, < 16ms, < 65ms, more)
+	static const char* const names[MCTRACESTAGES] = { "encode", "transmit", "ack", "receive", "auth", "gather" };
+	for(uint8_t stage=0; stage<MCTRACESTAGES; stage++) {
+		out.print(names[stage]);
+		out.print(' ');
+		out.print(_traceSum[stage]);
+		for(uint8_t bucket=0; bucket<MCTRACEBUCKETS; bucket++) {
+			out.print(' ');
+			out.print((unsigned int) _traceHist[stage][bucket]);
+		}
+		out.println();
+	}
+}
+#endif
+
+// template
+void MessageComLite::setTemplate(boolean enable) {
+	// the next createMessage() builds the template
+	_template = enable;
+	_templateValid = 0;
+}
+boolean MessageComLite::updateData(uint8_t index, uint8_t value) {
+	return updateDataBytes(index, &value, 1);
+}
+boolean MessageComLite::updateData(uint8_t index, char value) {
+	uint8_t bytes[1] = { (uint8_t) value };
+	return updateDataBytes(index, bytes, 1);
+}
+boolean MessageComLite::updateData(uint8_t index, uint16_t value) {
+	uint8_t bytes[2] = { (uint8_t) (value >> 8), (uint8_t) value };
+	return updateDataBytes(index, bytes, 2);
+}
+boolean MessageComLite::updateData(uint8_t index, int value) {
+	uint8_t bytes[2] = { (uint8_t) (value >> 8), (uint8_t) value };
+	return updateDataBytes(index, bytes, 2);
+}
+boolean MessageComLite::updateData(uint8_t index, long value) {
+	uint8_t bytes[4] = { (uint8_t) (value >> 24), (uint8_t) (value >> 16), (uint8_t) (value >> 8), (uint8_t) value };
+	return updateDataBytes(index, bytes, 4);
+}
+boolean MessageComLite::updateData(uint8_t index, unsigned long value) {
+	uint8_t bytes[4] = { (uint8_t) (value >> 24), (uint8_t) (value >> 16), (uint8_t) (value >> 8), (uint8_t) value };
+	return updateDataBytes(index, bytes, 4);
+}
+
+// non-blocking
+uint8_t MessageComLite::poll() {
+	// handle all bytes received so far, never waits
+	// returns the event: MCRECEIVED, MCSENT, MCFAILED, MCREFUSED or MCIDLE
+	// no own message took the due acknowledgement along in time
+	if(_ackDue && (millis()-_ackDueSince) >= MCACKDELAY)
+		flushAck();
+	if(_sendState != MCPENDING && recvQueued())
+		return MCRECEIVED;
+
+	while(available()) {
+		uint8_t value = (uint8_t) readByte();
+
+		if(_sendState == MCPENDING) {
+			// _buffer and _msg still hold the sent message,
+			// so messages of the peer go to the receive queue until it is answered
+			if(skipEcho(value)) {
+				// the echo is no answer of the peer
+			} else if(value == _ackChar) {
+				_ackCount++;
+			} else if(value == _nackChar) {
+				_nackCount++;
+			} else {
+				queueByte(value);
+				// the acknowledgement of the sent message came inside a message of the peer
+				if(_recvAck != 0 && _recvAck == _sendAck)
+					_ackCount = MCACKMINAMOUNT;
+			}
+
+			if(_sendSilent) {
+				if(_echoPos >= _echoSize) {
+					_sendState = MCSENT;
+					captureFlush();
+					return MCSENT;
+				}
+			} else if(_ackCount >= MCACKMINAMOUNT) {
+				MCTRACESTOP(MCTRACEACK);
+				_sendState = MCSENT;
+				_failCount = 0;
+				_lastLife = millis();
+				_awaitLife = 0;
+				captureFlush();
+				return MCSENT;
+			} else if(_nackCount >= MCACKMINAMOUNT) {
+				_sendState = MCREFUSED;
+				linkFailed();
+				captureFlush();
+				return MCREFUSED;
+			}
+			continue;
+		}
+
+		// the acknowledgement may wait for a message of the own
+		if(parseByte(value) && answer(1)) {
+			captureFlush();
+			return MCRECEIVED;
+		}
+	}
 
-uint8_t MessageComLite::getSize() {
+	if(_sendState == MCPENDING && (millis()-_sendStart) >= _sendTimeout) {
+		// a line without echo
+		if(_sendSilent) {
+			_sendState = MCSENT;
+			captureFlush();
+			return MCSENT;
+		}
+		_sendState = MCFAILED;
+		linkFailed();
+		captureFlush();
+		return MCFAILED;
+	}
+	if(_sendState != MCPENDING)
+		linkSilent();
+	captureFlush();
+	return MCIDLE;
+}
+boolean MessageComLite::sendAsync(unsigned long timeout) {
+	// send the message and return at once, poll() reports the acknowledgement
+	if(_sendState == MCPENDING || _bufferSize == 0)
+		return 0;
+
+	_recvPos = 0;
+	_ackCount = 0;
+	_nackCount = 0;
+	MCSize sentBytes = snd();
+	_sendStart = millis();
+	// the serial buffer may still hold most of the frame
+	_sendTimeout = (timeout+wireTime(sentBytes));
+	_sendState = MCPENDING;
+	// nobody answers a message to a group or to all nodes, poll() only skips its echo, see waitEcho()
+	_sendSilent = ((getDestinationFrom(&_msg[_frameStart]) & MCGROUP) != 0);
+	if(_sendSilent)
+		_sendTimeout = (MCTIMER+wireTime(sentBytes));
+	else
+		awaitLife();
+	return 1;
+}
+void MessageComLite::cancel() {
+	// stop waiting for the acknowledgement and for the rest of a message
+	if(_sendState == MCPENDING)
+		_sendState = MCIDLE;
+	_recvPos = 0;
+}
+uint8_t MessageComLite::getSendState() {
+	return _sendState;
+}
+
+// message
+boolean MessageComLite::swapMessage(MCMessage &message) {
+	// the queues and the link are sized for the own arrays,
+	// the echo and the acknowledgement of a pending message belong to the own one
+	if(message._bufferMaxSize != _bufferMaxSize || message._maxSize != _maxSize || _sendState == MCPENDING)
+		return 0;
+	MCMessage &own = *this;
+	MCMessage other(static_cast<MCMessage&&>(message));
+	message = static_cast<MCMessage&&>(own);
+	own = static_cast<MCMessage&&>(other);
+	return 1;
+}
+
+MCSize MessageComLite::getSize() {
 	return _size;
 }
 
 // clean up
 void MessageComLite::clear() {
 	// clear msg
-	for(uint8_t i=0; i<_bufferMaxSize; i++)
+	for(MCSize i=0; i<_bufferMaxSize; i++)
 		_buffer[i] = 0;
 
-	for(uint8_t i=0; i<_maxSize; i++)
+	for(MCSize i=0; i<_maxSize; i++)
 		_msg[i] = 0;
 
 	_dataSize = 0;
 	_bufferSize = 0;
 	_size = 0;
 
-	_version = 2;
+	_version = MCVERSION;
 	_type = 0;
 
 	_messageNumber = 1;
@@ -171,9 +1824,15 @@ void MessageComLite::clear() {
 	_dataCount = 0;
 	_nextData = 0; 
 
-	_data = &_msg[6];
+	_data = &_msg[MCHEADERSIZE];
+	_templateValid = 0;
+	_headerSize = MCHEADERSIZE;
+	_frameStart = 0;
+	_recvDestination = 0;
 
 	_commandStatus = 0;
+	useCheck(_check);
+	_paritySize = 0;
 	_checksum = 0;
 	_csH = 0;
 	_csL = 0;
@@ -187,11 +1846,16 @@ void MessageComLite::clear() {
 // identification
 void MessageComLite::getVersionFromMessage() {
 	// read the _version from the message
-	_version = _msg[0];
+	// a compact header has no version byte, its version is implied
+	if(_headerSize == MCHEADERSIZE)
+		_version = _msg[0];
 }
 void MessageComLite::getTypeFromMessage() {
 	// read the _type from the message
-	_type = _msg[1];
+	if(_headerSize == MCHEADERSIZE)
+		_type = _msg[1];
+	else
+		_type = (_msg[_frameStart] & MCCOMPACTTYPE);
 }
 void MessageComLite::setVersion(uint8_t version) {
 	_version = version;
@@ -199,11 +1863,19 @@ void MessageComLite::setVersion(uint8_t version) {
 void MessageComLite::setType(uint8_t type) {
 	_type = type;
 }
+uint8_t MessageComLite::getType() {
+	return _type;
+}
 
 // Command Status
 void MessageComLite::getCommandStatusFromMessage() {
 	// read the _commandStatus from the message
-	_commandStatus = _msg[2];
+	if(_headerSize == MCHEADERSIZE)
+		_commandStatus = _msg[2];
+	else if(_msg[_frameStart] & MCCOMPACTADDRESS)
+		_commandStatus = _msg[(_frameStart+2)];
+	else
+		_commandStatus = _msg[(_frameStart+1)];
 }
 void MessageComLite::setCommandStatus(boolean state, uint8_t taskValue) {
 	_commandStatus = createCommandStatus(state, taskValue);
@@ -238,11 +1910,22 @@ boolean MessageComLite::getStateFromCommandStatus(uint8_t cmdStatus) {
 // Message Info
 void MessageComLite::getMessageNumberFromMessage() {
 	// read the _messageNumber from the message
-	_messageNumber = _msg[3];
+	// a compact header without fragment fields is always message 1 of 1
+	if(_headerSize == MCHEADERSIZE)
+		_messageNumber = _msg[3];
+	else if(_msg[_frameStart] & MCCOMPACTFRAGMENTS)
+		_messageNumber = _msg[(_msg[_frameStart] & MCCOMPACTADDRESS) ? (_frameStart+3) : (_frameStart+2)];
+	else
+		_messageNumber = 1;
 }
 void MessageComLite::getTotalQuantityFromMessage() {
 	// read the _totalQuantity from the message
-	_totalQuantity = _msg[4];
+	if(_headerSize == MCHEADERSIZE)
+		_totalQuantity = _msg[4];
+	else if(_msg[_frameStart] & MCCOMPACTFRAGMENTS)
+		_totalQuantity = _msg[(_msg[_frameStart] & MCCOMPACTADDRESS) ? (_frameStart+4) : (_frameStart+3)];
+	else
+		_totalQuantity = 1;
 }
 void MessageComLite::setMessageNumber(uint8_t messageNumber) {
 	_messageNumber = messageNumber;
@@ -254,9 +1937,11 @@ void MessageComLite::setTotalQuantity(uint8_t totalQuantity) {
 // DataSize
 void MessageComLite::getDataSizeFromMessage() {
 	// read the _dataSize from the message
-	_dataSize = _msg[5];
+	// a compact header has no size byte, the size follows from the frame length (see authMsg)
+	if(_headerSize == MCHEADERSIZE)
+		_dataSize = getSizeFrom(_msg);
 }
-void MessageComLite::setDataSize(uint8_t dataSize) {
+void MessageComLite::setDataSize(MCSize dataSize) {
 	_dataSize = dataSize;
 }
 
@@ -265,19 +1950,19 @@ void MessageComLite::getDataFromMessage() {
 	// read _data from the message
 	if(0 < _dataSize && (_dataSize <= _maxSize)) {
 		// set pointer to the data begin of the _msg array
-		_data = &_msg[6];
+		_data = &_msg[MCHEADERSIZE];
 	}
 }
 
 boolean MessageComLite::addToData(char *value) {
-	uint8_t size = strlen(value);
+	MCSize size = strlen(value);
 	uint8_t enh = extendDataTo(size);
-	uint8_t pos = (_dataSize-size);
+	MCSize pos = (_dataSize-size);
 	if(enh == 2)
 		_data[(pos-1)] = _delimiter;
 
 	if(enh == 1 || enh == 2) {
-		for(uint8_t i=0; i<size; i++) {
+		for(MCSize i=0; i<size; i++) {
 			_data[(pos+i)] = value[i];
 		}
 		return 1;
@@ -393,36 +2078,93 @@ boolean MessageComLite::addToData(unsigned long value) {
 	return 0;
 }
 
+MCSize MessageComLite::addArrayField(MCSize size) {
+	// the whole array becomes one field: one bounds check, one delimiter
+	// the values follow the delimiter as marker and their size, so they may contain the delimiter
+	// returns the position of the values or MCNOPOS
+	MCSize space = getDataSpace();
+	if(size == 0 || space < (1+MCSIZEBYTES) || size > (space-1-MCSIZEBYTES))
+		return MCNOPOS;
+	uint8_t enh = extendDataTo((1+MCSIZEBYTES+size));
+	if(enh == 0)
+		return MCNOPOS;
+
+	MCSize pos = (_dataSize-size-1-MCSIZEBYTES);
+	if(enh == 2)
+		_data[(pos-1)] = _delimiter;
+	_data[pos++] = _delimiter;
+#ifdef MCLARGEFRAMES
+	_data[pos++] = (uint8_t) (size >> 8);
+#endif
+	_data[pos++] = (uint8_t) size;
+	return pos;
+}
+boolean MessageComLite::addArrayToData(const uint8_t *values, MCSize count) {
+	MCSize pos = addArrayField(count);
+	if(pos == MCNOPOS)
+		return 0;
+	memcpy(&_data[pos], values, count);
+	return 1;
+}
+boolean MessageComLite::addArrayToData(const int16_t *values, MCSize count) {
+	// every value takes 2 bytes, high byte first (like addToData(int))
+	// count*2 must not wrap around, so the space is checked on the count
+	if(count > (getDataSpace()/2))
+		return 0;
+	MCSize pos = addArrayField((count*2));
+	if(pos == MCNOPOS)
+		return 0;
+	for(MCSize i=0; i<count; i++) {
+		_data[pos++] = (uint8_t) (values[i] >> 8);
+		_data[pos++] = (uint8_t) values[i];
+	}
+	return 1;
+}
+boolean MessageComLite::addArrayToData(const uint16_t *values, MCSize count) {
+	// every value takes 2 bytes, high byte first (like addToData(uint16_t))
+	// count*2 must not wrap around, so the space is checked on the count
+	if(count > (getDataSpace()/2))
+		return 0;
+	MCSize pos = addArrayField((count*2));
+	if(pos == MCNOPOS)
+		return 0;
+	for(MCSize i=0; i<count; i++) {
+		_data[pos++] = (uint8_t) (values[i] >> 8);
+		_data[pos++] = (uint8_t) values[i];
+	}
+	return 1;
+}
+
 uint8_t MessageComLite::getUint8FromData(uint8_t index) {
-	uint8_t len;
+	MCSize len;
 	int start, stop;
 	getPositionsOfIndexFromData(index, len, start, stop);
 
 	return (uint8_t) _data[start];
 }
 char* MessageComLite::getCharArrayFromData(uint8_t index) {
-	uint8_t len;
+	MCSize len;
 	int start, stop;
 	getPositionsOfIndexFromData(index, len, start, stop);
 
 	char result[len];
 
-	uint8_t cnt = 0;
-	for(uint8_t i=start; i<stop; i++)
+	MCSize cnt = 0;
+	for(MCSize i=start; i<stop; i++)
 		result[cnt++] = (char) _data[i];
 
 	result[len-1] = '\0';
 	return result;
 }
 char MessageComLite::getCharFromData(uint8_t index) {
-	uint8_t len;
+	MCSize len;
 	int start, stop;
 	getPositionsOfIndexFromData(index, len, start, stop);
 
 	return (char) _data[start];
 }
 uint16_t MessageComLite::getUint16FromData(uint8_t index) {
-	uint8_t len;
+	MCSize len;
 	int start, stop;
 	getPositionsOfIndexFromData(index, len, start, stop);
 
@@ -435,7 +2177,7 @@ uint16_t MessageComLite::getUint16FromData(uint8_t index) {
 
 }
 int MessageComLite::getIntFromData(uint8_t index) {
-	uint8_t len;
+	MCSize len;
 	int start, stop;
 	getPositionsOfIndexFromData(index, len, start, stop);
 
@@ -447,7 +2189,7 @@ int MessageComLite::getIntFromData(uint8_t index) {
 	return result;
 }
 long MessageComLite::getLongFromData(uint8_t index) {
-	uint8_t len;
+	MCSize len;
 	int start, stop;
 	getPositionsOfIndexFromData(index, len, start, stop);
 
@@ -465,7 +2207,7 @@ long MessageComLite::getLongFromData(uint8_t index) {
 	return result;
 }
 unsigned long MessageComLite::getUnsignedLongFromData(uint8_t index) {
-	uint8_t len;
+	MCSize len;
 	int start, stop;
 	getPositionsOfIndexFromData(index, len, start, stop);
 
@@ -483,15 +2225,63 @@ unsigned long MessageComLite::getUnsignedLongFromData(uint8_t index) {
 	return result;
 }
 
+MCSize MessageComLite::getArrayFromData(uint8_t index, uint8_t *values, MCSize count) {
+	MCSize len;
+	int start, stop;
+	getPositionsOfIndexFromData(index, len, start, stop);
+
+	// copy at most count values, return the number of copied values
+	MCSize cnt = (stop-start);
+	if(cnt > count)
+		cnt = count;
+	memcpy(values, &_data[start], cnt);
+	return cnt;
+}
+MCSize MessageComLite::getArrayFromData(uint8_t index, int16_t *values, MCSize count) {
+	MCSize len;
+	int start, stop;
+	getPositionsOfIndexFromData(index, len, start, stop);
+
+	// copy at most count values, return the number of copied values
+	MCSize cnt = ((stop-start)/2);
+	if(cnt > count)
+		cnt = count;
+	for(MCSize i=0; i<cnt; i++) {
+		values[i] = (int16_t) (((uint16_t) _data[start] << 8) | _data[(start+1)]);
+		start += 2;
+	}
+	return cnt;
+}
+MCSize MessageComLite::getArrayFromData(uint8_t index, uint16_t *values, MCSize count) {
+	MCSize len;
+	int start, stop;
+	getPositionsOfIndexFromData(index, len, start, stop);
+
+	// copy at most count values, return the number of copied values
+	MCSize cnt = ((stop-start)/2);
+	if(cnt > count)
+		cnt = count;
+	for(MCSize i=0; i<cnt; i++) {
+		values[i] = (((uint16_t) _data[start] << 8) | _data[(start+1)]);
+		start += 2;
+	}
+	return cnt;
+}
+
 uint8_t MessageComLite::getDataCount() {
 	int start = 0, stop = 0;
 	uint8_t cnt = 0;
 
 	while(1) {
-		if((stop = indexOf(_data, _delimiter, start, _dataSize)) < 0)
-			break; 
+		// indexOf includes the end position, the checksum behind the data is no delimiter
+		stop = indexOf(_data, _delimiter, getArrayEndAt(start), _dataSize);
+		if(stop < 0 || stop >= _dataSize)
+			break;
 		cnt++;
 		start = stop+1;
+		// the fields behind MCMAXFIELDS can not be read by index, a peer may still send them
+		if(cnt == (MCMAXFIELDS-1))
+			break;
 	}
 	// the expression above only counts the occurrence of the delimiter
 	// we have to increment it again if more than one delimiter were found
@@ -536,48 +2326,32 @@ uint8_t MessageComLite::nextData() {
 // Checksum
 void MessageComLite::getCsHFromMessage() {
 	// read the _csH from the message
-	_csH = _msg[(6+_dataSize)];
+	_csH = _msg[(MCHEADERSIZE+_dataSize)];
 }
 void MessageComLite::getCsLFromMessage() {
 	// read the _csL from the message
-	_csL = _msg[(7+_dataSize)];
+	_csL = _msg[(MCHEADERSIZE+1+_dataSize)];
 }
 void MessageComLite::getChecksumFromMessage() {
 	// read the _csL from the message
 	getCsHFromMessage();
 	getCsLFromMessage();
 
-	_checksum = (uint16_t) _csH;
-	_checksum = _checksum << 8;
-	for(uint8_t i=0; i<8; i++)
-		bitWrite(_checksum, i, bitRead(_csL, i));
+	_checksum = readChecksum(&_msg[(MCHEADERSIZE+_dataSize)], _checkSize);
 }
-uint16_t MessageComLite::getChecksumFrom(uint8_t *array, uint8_t startPos) {
-	uint8_t tmpPos = (startPos+array[(startPos+5)]+6);
-	uint8_t csH = array[tmpPos];
-	uint8_t csL = array[(tmpPos+1)];
-
-	uint16_t checksum = (uint16_t) csH;
-	checksum = checksum << 8;
-	for(uint8_t i=0; i<8; i++)
-		bitWrite(checksum, i, bitRead(csL, i));
-	return checksum;
+uint32_t MessageComLite::getChecksumFrom(uint8_t *array, MCSize startPos) {
+	return readChecksum(&array[(startPos+_headerSize+_dataSize)], _checkSize);
 }
-uint16_t MessageComLite::makeCrcFrom(uint8_t *array, uint8_t startPos) {
-	uint16_t retval = 0xffff;
-	// uint16_t retval = 0x0; // init for xmodem
+uint32_t MessageComLite::makeCrcFrom(uint8_t *array, MCSize startPos) {
 	// get the checksum for the whole message
-	// excluding: start-, stop-byte and the 2 checksum bytes
-	// (6+_dataSize-1)
-	for(uint8_t i=(startPos); i<=(startPos+5+_dataSize); i++) {
-		retval = _crc_ccitt_update(retval, (uint8_t) array[i]);
-		// retval = _crc_xmodem_update(retval, array[i]);
-	}
-	return retval;
+	// excluding: start-, stop-byte and the checksum bytes
+	uint32_t retval = checksumStart(_msgCheck);
+	retval = checksumUpdate(_msgCheck, retval, &array[startPos], (_headerSize+_dataSize));
+	return checksumFinish(_msgCheck, retval);
 }
 void MessageComLite::setCrc() {
-	_checksum = makeCrcFrom(_msg);
-	getCrcLH(_checksum);
+	_checksum = makeCrcFrom(_msg, _frameStart);
+	getCrcLH((uint16_t) _checksum);
 }
 void MessageComLite::getCrcLH(uint16_t checksum) {
 	_csL = (uint8_t) checksum;
@@ -588,12 +2362,12 @@ boolean MessageComLite::crcOk() {
 	// get the transmitted checksum -> _checksum
 	getChecksumFromMessage();
 	// make your own checksum and compare it to the transmitted
-	if(makeCrcFrom(_msg) == _checksum)
+	if(makeCrcFrom(_msg, _frameStart) == _checksum)
 		return 1;
 	return 0;
 }
-boolean MessageComLite::crcOk(uint8_t *array, uint8_t startPos) {
-	uint16_t checksum = getChecksumFrom(array, startPos);
+boolean MessageComLite::crcOk(uint8_t *array, MCSize startPos) {
+	uint32_t checksum = getChecksumFrom(array, startPos);
 	// make your own checksum and compare it to the transmitted
 	if(makeCrcFrom(array, startPos) == checksum)
 		return 1;
@@ -602,10 +2376,12 @@ boolean MessageComLite::crcOk(uint8_t *array, uint8_t startPos) {
 
 
 void MessageComLite::gatherInfoFromMessage() {
+	MCTRACESTART(MCTRACEGATHER);
 	getVersionFromMessage();
 	getTypeFromMessage();
 
 	getCommandStatusFromMessage();
+	_recvDestination = getDestinationFrom(&_msg[_frameStart]);
 	
 	getMessageNumberFromMessage();
 	getTotalQuantityFromMessage();
@@ -615,6 +2391,7 @@ void MessageComLite::gatherInfoFromMessage() {
 	getDataFromMessage();
 
 	getChecksumFromMessage();
+	MCTRACESTOP(MCTRACEGATHER);
 }
 
 
@@ -626,35 +2403,126 @@ void MessageComLite::createMessage(uint8_t taskValue, boolean state, uint8_t mes
 }
 
 void MessageComLite::createMessage() {
+	MCTRACESTART(MCTRACEENCODE);
+	// only the compact header carries a destination and it holds the types up to MCCOMPACTTYPE:
+	// no message then, it would reach every node; the handshake goes without address
+	if(_destination != 0 && _type > MCCOMPACTTYPE && _type != MCTYPELINK) {
+		_bufferSize = 0;
+		_templateValid = 0;
+		MCTRACESTOP(MCTRACEENCODE);
+		return;
+	}
 	// create a message and debug it.
-	if((_size+8) <= _maxSize) {
-		// extend the size of the message
-		_size = (8+_dataSize);
-
-		_msg[0] = _version;
-		_msg[1] = _type;
-		_msg[2] = _commandStatus;
-		_msg[3] = _messageNumber;
-		_msg[4] = _totalQuantity;
-		_msg[5] = _dataSize;
+	if((MCHEADERSIZE+_dataSize+checkSizeOf(_check)) <= _maxSize) {
+		uint8_t header[MCHEADERSIZE];
+		uint8_t headerSize = 0;
+		// a destination is only carried by the compact header
+		if((_compact || _destination != 0) && _type <= MCCOMPACTTYPE) {
+			// compact header: it ends right in front of the data,
+			// so the frame starts at _frameStart and the data stays at _msg[MCHEADERSIZE]
+			uint8_t flags = MCCOMPACT;
+			if(_messageNumber != 1 || _totalQuantity != 1)
+				flags |= MCCOMPACTFRAGMENTS;
+			if(_destination != 0)
+				flags |= MCCOMPACTADDRESS;
+
+			header[headerSize++] = (flags | _type);
+			if(_destination != 0)
+				header[headerSize++] = _destination;
+			header[headerSize++] = _commandStatus;
+			if(flags & MCCOMPACTFRAGMENTS) {
+				header[headerSize++] = _messageNumber;
+				header[headerSize++] = _totalQuantity;
+			}
+			// the acknowledgement is set when the message is sent, see snd()
+			if(_ackFrame && _destination == 0)
+				header[headerSize++] = 0;
+		} else {
+			header[headerSize++] = _version;
+			header[headerSize++] = _type;
+			header[headerSize++] = _commandStatus;
+			header[headerSize++] = _messageNumber;
+			header[headerSize++] = _totalQuantity;
+#ifdef MCLARGEFRAMES
+			header[headerSize++] = (uint8_t) (_dataSize >> 8);
+#endif
+			header[headerSize++] = (uint8_t) _dataSize;
+		}
+
+		// template: the layout of the cached message is unchanged,
+		// so only the groups of the changed bytes are encoded again
+		if(_templateValid && headerSize == _headerSize && (_headerSize+_dataSize+_checkSize) == _size) {
+			for(uint8_t i=0; i<_headerSize; i++) {
+				if(_msg[(_frameStart+i)] != header[i]) {
+					_msg[(_frameStart+i)] = header[i];
+					markDirty(i);
+				}
+			}
+			updateTemplate();
+			MCTRACESTOP(MCTRACEENCODE);
+			return;
+		}
+
+		_headerSize = headerSize;
+		_frameStart = (MCHEADERSIZE-_headerSize);
+		memcpy(&_msg[_frameStart], header, _headerSize);
+		// handshake messages always carry the CRC-16, so every peer can read them
+		if(_headerSize == MCHEADERSIZE && _type == MCTYPELINK)
+			useCheck(MCCHECKCRC16);
+		else
+			useCheck(_check);
+
 		// then comes the data, usually we would copy _data to _msg, 
 		// but _data shares the memory with _msg... so its not necessary
 
+		// extend the size of the message
+		_size = (_headerSize+_dataSize+_checkSize);
+
 		// _checksum
 		setCrc();
-		_msg[(6+_dataSize)] = _csH;
-		_msg[(6+_dataSize+1)] = _csL;
+		writeChecksum(&_msg[(MCHEADERSIZE+_dataSize)]);
+
+		// forward error correction: the parity follows the checksum, getDataSpace() keeps room for it in _msg
+		// every frame of the link carries it, a message without room for it is not sent
+		// handshake messages carry none, so every peer can read them
+		_paritySize = 0;
+		if(_fec && !(_headerSize == MCHEADERSIZE && _type == MCTYPELINK)) {
+			if((_frameStart+_size+fecParityOf(_size)) > _maxSize) {
+				_bufferSize = 0;
+				_templateValid = 0;
+				MCTRACESTOP(MCTRACEENCODE);
+				return;
+			}
+			_paritySize = fecEncode(&_msg[_frameStart], _size);
+		}
+
+		_bufferSize = (1+base64Encode(&_buffer[1], &_msg[_frameStart], (_size+_paritySize)));
+
 
-		_bufferSize = base64_encode(_buffer, _msg, _size, 1);
-		
 		_buffer[0] = _startDelimiter;
+		// the receiver corrects only a frame marked as one with parity
+		if(_paritySize > 0)
+			_buffer[_bufferSize++] = MCFECMARK;
 		_buffer[_bufferSize++] = _stopDelimiter;
 		_buffer[_bufferSize++] = '\0';
+
+		if(_template) {
+			// this message is the new template, the checksum state in front of byte 0 is the initial value
+			_templateValid = 1;
+			_crcPos = 0;
+			_crcCache = checksumStart(_msgCheck);
+			_dirtyFrom = MCNOPOS;
+			_dirtyTo = 0;
+		}
 	}
+	MCTRACESTOP(MCTRACEENCODE);
 }
 
 
 boolean MessageComLite::authMsg(uint8_t *array) {
+	MCTRACESTART(MCTRACEAUTH);
+	_foreign = 0;
+
 	int startPos = indexOf(array, _startDelimiter, 0, _bufferMaxSize);
 	if(startPos > -1) {
 		// try to prevent timing errors:
@@ -663,26 +2531,100 @@ boolean MessageComLite::authMsg(uint8_t *array) {
 		if(startPos2 > -1)
 			startPos = startPos2;
 
-		int endPos = indexOf(array, _stopDelimiter, (startPos+10), _bufferMaxSize);
+		// the shortest message (compact header, no data) takes 8 chars
+		int endPos = indexOf(array, _stopDelimiter, (startPos+9), _bufferMaxSize);
 		if(endPos > -1) {
-			// (endPos-startPos) >= 11 // implicit true
+			// (endPos-startPos) >= 9 // implicit true
 			// start and found
-			// base64-decode the message to get its content
-			base64_decode(_msg, array, (endPos-startPos-1), (startPos+1));
-			// get data size from message
-			getDataSizeFromMessage();
-			// authentificate message
-			// match version
-			if(_msg[0] == _version) {
-				// verify the transmitted checksum
-				if(crcOk(_msg)) {
-					// message authentic!
-					_size = (_dataSize+8);
-					return 1;
+			uint8_t *encoded = &array[(startPos+1)];
+			MCSize encodedLen = (endPos-startPos-1);
+			boolean parity = (encoded[(encodedLen-1)] == MCFECMARK);
+			if(parity)
+				encodedLen--;
+
+			// the first quad tells the header format
+			uint8_t header[(MCHEADERSIZE+2)];
+			boolean quadOk = ((encodedLen % 4) == 0 && base64DecodeQuad(header, encoded) == 3);
+
+			// forward error correction: the corrected frame replaces the received one,
+			// a message to another node is not corrected, the other header bytes may be the wrong ones
+			if(parity && (!quadOk || addressedToMe(getDestinationFrom(header)))) {
+				MCSize correctedLen = fecCorrect(encoded, encodedLen);
+				// more wrong bytes than the parity can correct
+				quadOk = (correctedLen < encodedLen && base64DecodeQuad(header, encoded) == 3);
+				encodedLen = correctedLen;
+			}
+
+			if(quadOk) {
+				// and the destination: a message to another node is skipped undecoded,
+				// _msg still holds the own message
+				if(!addressedToMe(getDestinationFrom(header))) {
+					_foreign = 1;
+					MCTRACESTOP(MCTRACEAUTH);
+					return 0;
+				}
+
+				// the size of the frame follows from the encoded length and its padding
+				MCSize frameLen = ((encodedLen/4)*3);
+				if(encoded[(encodedLen-1)] == '=')
+					frameLen--;
+				if(encoded[(encodedLen-2)] == '=')
+					frameLen--;
+
+				// handshake messages always carry the CRC-16, so every peer can read them
+				if(!(header[0] & MCCOMPACT) && header[1] == MCTYPELINK)
+					useCheck(MCCHECKCRC16);
+				else
+					useCheck(_check);
+
+				// reject what can not be a message before the full decode and the checksum
+				boolean headerOk = 0;
+				if(header[0] & MCCOMPACT) {
+					_headerSize = compactHeaderSize(header[0]);
+					headerOk = (frameLen >= (_headerSize+_checkSize));
+				} else {
+					// match version, the size byte is in the 2nd quad
+					_headerSize = MCHEADERSIZE;
+					headerOk = (header[0] == _version &&
+						base64DecodeQuad(&header[3], &encoded[4]) == 3);
+#ifdef MCLARGEFRAMES
+					// ... and the low byte of the size in the 3rd
+					headerOk = (headerOk && encodedLen >= 12 &&
+						base64DecodeQuad(&header[6], &encoded[8]) == 3);
+#endif
+					headerOk = (headerOk && frameLen == (MCHEADERSIZE+getSizeFrom(header)+_checkSize));
+				}
+				_frameStart = (MCHEADERSIZE-_headerSize);
+
+				// the decoded message has to fit into _msg
+				if(headerOk && frameLen <= (_maxSize-_frameStart)) {
+					// the received message replaces the template
+					_templateValid = 0;
+					// base64-decode the message to get its content,
+					// a char outside the alphabet ends it early
+					headerOk = (base64Decode(&_msg[_frameStart], encoded, encodedLen) == frameLen);
+
+					if(_headerSize == MCHEADERSIZE) {
+						// get data size from message
+						getDataSizeFromMessage();
+					} else {
+						// the compact header has no size byte
+						_dataSize = (frameLen-_headerSize-_checkSize);
+					}
+					// verify the transmitted checksum
+					if(headerOk && crcOk(_msg, _frameStart)) {
+						// message authentic!
+						_size = (_headerSize+_dataSize+_checkSize);
+						_lastLife = millis();
+						_awaitLife = 0;
+						MCTRACESTOP(MCTRACEAUTH);
+						return 1;
+					}
 				}
 			}
 		}
 	}
+	MCTRACESTOP(MCTRACEAUTH);
 	clear();
 	return 0;
 }
@@ -695,205 +2637,243 @@ boolean MessageComLite::readMsg(uint8_t *buffer) {
 	return 0;
 }
 
-boolean MessageComLite::recv(uint8_t maxtry, unsigned long timer, uint8_t sBytes) {
+boolean MessageComLite::recv(uint8_t maxtry, unsigned long timer, MCSize sBytes) {
 	if(sBytes > 0)
 		skipBytes(sBytes);
 
-	uint8_t recvBytePos = 0;
+	MCSize recvBytePos = 0;
 
 	for(uint8_t atry=0; atry<maxtry; atry++) {
 
-		for(uint8_t i=0; i<_bufferMaxSize; i++)
+		for(MCSize i=0; i<_bufferMaxSize; i++)
 			_buffer[i] = 0;
 
 		// buffer the message from HW-Serial or SW-Serial
-		if(_Serial != NULL) {
-			if(_Serial->available()) {
-				for(int i=0; i<1000; i++) {
-					// read value from device
-					uint8_t value = (uint8_t) _Serial->read();
-					// look for startDelimiter
-					if(value == _startDelimiter) {
-						// start found 
-						_buffer[recvBytePos++] = value;
-
-						// just to be sure ... try many times
-						for(int j=0; j<1000; j++) {
-							// read value from device
-							value = (uint8_t) _Serial->read();
-							// look for startDelimiter ... and also for the end
-							if(value == _stopDelimiter) {
-								// stop found
-								_buffer[recvBytePos++] = value;
-								if(readMsg(_buffer))
-									return 1;
-							} else if(bytePlausible(value)) {
-								_buffer[recvBytePos++] = value;
-							}
+		if(available()) {
+			for(int i=0; i<1000; i++) {
+				// read value from device
+				uint8_t value = (uint8_t) readByte();
+				// look for startDelimiter
+				if(value == _startDelimiter) {
+					// start found 
+					MCTRACESTART(MCTRACERECEIVE);
+					_buffer[recvBytePos++] = value;
+
+					// just to be sure ... try many times
+					// a large frame needs at least one try per char
+					for(long j=0; j<(1000L+_bufferMaxSize); j++) {
+						// wait only for a byte that is not there yet, a frame in the serial buffer is read at once
+						if(!available()) {
 							delay(1);
+							continue;
 						}
-						// start found once ... 
-						// there is no purpose for another time to receive either the end was found or not
-						recvBytePos = 0;
-						break;
-					}
-					delay(5);
-				}
-			}
-		} else if(_swSerial != NULL) {
-			if(_swSerial->available()) {
-				for(int i=0; i<1000; i++) {
-					// read value from device
-					uint8_t value = (uint8_t) _swSerial->read();
-					// look for startDelimiter
-					if(value == _startDelimiter) {
-						// start found 
-						_buffer[recvBytePos++] = value;
-
-						// just to be sure ... try many times
-						for(int j=0; j<1000; j++) {
-							// read value from device
-							value = (uint8_t) _swSerial->read();
-							// look for startDelimiter ... and also for the end
-							if(value == _stopDelimiter) {
-								// stop found
-								_buffer[recvBytePos++] = value;
-								if(readMsg(_buffer))
-									return 1;
-							} else if(bytePlausible(value)) {
-								_buffer[recvBytePos++] = value;
+						// read value from device
+						value = (uint8_t) readByte();
+						// look for startDelimiter ... and also for the end
+						if(value == _stopDelimiter) {
+							// stop found
+							MCTRACESTOP(MCTRACERECEIVE);
+							_buffer[recvBytePos++] = value;
+							if(readMsg(_buffer)) {
+								captureFlush();
+								return 1;
 							}
-							delay(1);
+							if(_foreign) {
+								// not for this node: wait for the next message
+								memset(_buffer, 0, _bufferMaxSize);
+								recvBytePos = 0;
+							} else {
+								// a garbled message: maybe the link degraded
+								linkFailed();
+							}
+						} else if(byteInFrame(value) && recvBytePos < (_bufferMaxSize-2)) {
+							// the stop delimiter always has room behind it
+							_buffer[recvBytePos++] = value;
 						}
-						// start found once ... 
-						// there is no purpose for another time to receive either the end was found or not
-						recvBytePos = 0;
-						break;
 					}
-					delay(5);
+					// start found once ... 
+					// there is no purpose for another time to receive either the end was found or not
+					recvBytePos = 0;
+					break;
 				}
+				delay(5);
 			}
 		}
 		delay(timer*3);
 	}
+	linkSilent();
+	captureFlush();
 	return 0;
 }
 
-boolean MessageComLite::receiveAck(uint8_t sBytes) {
-	if(sBytes > 0)
-		skipBytes(sBytes);
+boolean MessageComLite::receiveAck(MCSize sBytes) {
+	// sBytes: the sent bytes, their echo is skipped as long as it matches the sent message
+	if(sBytes == 0)
+		_echoPos = _echoSize;
 
 	uint8_t ack = 0, nack = 0;
 
 	for(uint8_t atry=0; atry<MCMAXTRY; atry++) {
 
 		// buffer the message from HW-Serial or SW-Serial
-		if(_Serial != NULL) {
-			if(_Serial->available()) {
-				for(int i=0; i<1000; i++) {
-					// read value from device
-					uint8_t value = (uint8_t) _Serial->read();
-					// look for ack or nack
-					if(value == _ackChar)
-						ack++;
-					else if(value == _ackChar)
-						nack++;
-
-					if(ack >= MCACKMINAMOUNT)
-						return 1;
-					else if(nack >= MCACKMINAMOUNT)
-						return 0;
-
-					delay(2);
+		if(available()) {
+			for(int i=0; i<1000; i++) {
+				// read value from device
+				uint8_t value = (uint8_t) readByte();
+				// look for ack or nack
+				// every other byte may belong to a message the peer sent meanwhile
+				if(skipEcho(value))
+					continue;
+				if(value == _ackChar) {
+					ack++;
+				} else if(value == _nackChar) {
+					nack++;
+				} else {
+					queueByte(value);
+					// the acknowledgement of the sent message came inside a message of the peer
+					if(_recvAck != 0 && _recvAck == _sendAck)
+						ack = MCACKMINAMOUNT;
 				}
-			}
-		} else if(_swSerial != NULL) {
-			if(_swSerial->available()) {
-				for(int i=0; i<1000; i++) {
-					// read value from device
-					uint8_t value = (uint8_t) _swSerial->read();
-					// look for ack or nack
-					if(value == _ackChar)
-						ack++;
-					else if(value == _ackChar)
-						nack++;
-
-					if(ack >= MCACKMINAMOUNT)
-						return 1;
-					else if(nack >= MCACKMINAMOUNT)
-						return 0;
 
-					delay(2);
+				if(ack >= MCACKMINAMOUNT) {
+					MCTRACESTOP(MCTRACEACK);
+					captureFlush();
+					return 1;
+				} else if(nack >= MCACKMINAMOUNT) {
+					captureFlush();
+					return 0;
 				}
+
+				delay(2);
 			}
 		}
 		delay(MCTIMER);
 	}
+	captureFlush();
 	return 0;
 }
 
 boolean MessageComLite::receive(uint8_t maxtry, unsigned long timer) {
-	if(recv(maxtry, timer)) {
-		if(getState()) {
+	// a message received while waiting for an acknowledgement is already acknowledged
+	if(recvQueued())
+		return 1;
+	if(recv(maxtry, timer))
+		return answer();
+	return 0;
+}
+boolean MessageComLite::answer(boolean later) {
+	// answer a received message
+	// later: non-blocking, the acknowledgement may ride in the next message to the peer
+	// handshake messages are answered here, they never reach the application
+	if(_type == MCTYPELINK) {
+		MCSize maxSize;
+		uint8_t features;
+		unsigned long maxBaud;
+		if(getTaskValue() == MCLINKOFFER && readLinkMessage(maxSize, features, maxBaud)) {
 			sendAck(1);
-			return 1;
+			if(createLinkMessage(MCLINKREPLY))
+				snd();
+			clear();
+			useLink(maxSize, features, maxBaud);
+		}
+		return 0;
+	}
+
+	// a message to a group or to all nodes is not acknowledged, the answers would collide
+	if(_recvDestination & MCGROUP)
+		return getState();
+
+	if(getState()) {
+		// on a bus the answer goes to a destination and carries none, so it is sent at once there
+		if(later && _ackFrame && _recvDestination == 0) {
+			// poll() or snd() send it, see flushAck()
+			_ackDue = 1;
+			_ackDueSince = millis();
+			_ackValue = getFrameAck();
 		} else {
-			sendAck(0);
+			sendAck(1);
 		}
+		return 1;
+	} else {
+		sendAck(0);
 	}
 	return 0;
 }
 
-uint8_t MessageComLite::snd() {
-	uint8_t sentBytes = 0;
-	if(_Serial != NULL) {
-		for(uint8_t i=0; i<_bufferSize; i++) {
-			if(bytePlausible(_buffer[i])) {
-				_Serial->write(_buffer[i]);
-				sentBytes++;
-			}
-		}
-		_Serial->println();
-	} else if(_swSerial != NULL) {
-		for(uint8_t i=0; i<_bufferSize; i++) {
-			if(bytePlausible(_buffer[i])) {
-				_swSerial->write(_buffer[i]);
+MCSize MessageComLite::snd() {
+	// a due acknowledgement rides in a compact message without destination,
+	// the one of an earlier send is taken out again, so a repeated message acknowledges nothing
+	if(_ackFrame && _bufferSize > 0 &&
+		(_msg[_frameStart] & MCCOMPACT) && !(_msg[_frameStart] & MCCOMPACTADDRESS)) {
+		carryAck((_ackDue ? _ackValue : 0));
+		_ackDue = 0;
+	}
+	_sendAck = getFrameAck();
+	return sndFrom(_buffer, _bufferSize);
+}
+MCSize MessageComLite::sndFrom(uint8_t *buffer, MCSize bufferSize) {
+	MCSize sentBytes = 0;
+	// the acknowledgement of the peer goes first
+	flushAck();
+	_recvAck = 0;
+	// the echo of the message is expected next
+	_echoFrame = buffer;
+	_echoSize = bufferSize;
+	_echoPos = 0;
+	if(_Serial != NULL || _swSerial != NULL) {
+		MCTRACESTART(MCTRACETRANSMIT);
+		for(MCSize i=0; i<bufferSize; i++) {
+			if(bytePlausible(buffer[i])) {
+				writeByte(buffer[i]);
 				sentBytes++;
 			}
 		}
-		_swSerial->println();
+		writeByte('\r');
+		writeByte('\n');
+		MCTRACESTOP(MCTRACETRANSMIT);
+		// the wait for the acknowledgement starts with the last byte
+		MCTRACESTART(MCTRACEACK);
 	}
+	captureFlush();
 	return sentBytes;
 }
 void MessageComLite::sendAck(boolean state) {
-	if(state) {
-		if(_Serial != NULL) {
-			for(uint8_t i=0; i<MCACKCOUNT; i++)
-				_Serial->write(_ackChar);
-			_Serial->println();
-		} else if(_swSerial != NULL) {
-			for(uint8_t i=0; i<MCACKCOUNT; i++)
-				_swSerial->write(_ackChar);
-			_swSerial->println();
-		}
-	} else {
-		if(_Serial != NULL) {
-			for(uint8_t i=0; i<MCACKCOUNT; i++)
-				_Serial->write(_nackChar);
-			_Serial->println();
-		} else if(_swSerial != NULL) {
-			for(uint8_t i=0; i<MCACKCOUNT; i++)
-				_swSerial->write(_nackChar);
-			_swSerial->println();
-		}
+	char value = _nackChar;
+	if(state)
+		value = _ackChar;
+
+	if(_Serial != NULL || _swSerial != NULL) {
+		for(uint8_t i=0; i<MCACKCOUNT; i++)
+			writeByte(value);
+		writeByte('\r');
+		writeByte('\n');
+		// a half-duplex line sends them back, readByte() drops them
+		if(_echoLine && state && _echoAcks <= (255-MCACKCOUNT))
+			_echoAcks += MCACKCOUNT;
+		else if(_echoLine && !state && _echoNacks <= (255-MCACKCOUNT))
+			_echoNacks += MCACKCOUNT;
 	}
+	captureFlush();
 }
 
 boolean MessageComLite::send() {
-	uint8_t skipBytes = snd();
+	// createMessage() refused the message
+	if(_bufferSize == 0)
+		return 0;
+	MCSize sentBytes = snd();
+	// nobody answers a message to a group or to all nodes
+	if(getDestinationFrom(&_msg[_frameStart]) & MCGROUP) {
+		waitEcho(sentBytes);
+		return 1;
+	}
+	awaitLife();
 	delay(MCTIMER);
-	if(receiveAck(skipBytes)) {
+	if(receiveAck(sentBytes)) {
+		_failCount = 0;
+		_lastLife = millis();
+		_awaitLife = 0;
 		return 1;
 	}
+	linkFailed();
 	return 0;
 }
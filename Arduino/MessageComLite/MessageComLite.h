@@ -8,7 +8,7 @@
 	Link:
 		http://arduino.cc/de/Reference/SoftwareSerial
 	
-	Base64 library by Adam Rudd
+	The base64 coding is built in, it is based on the Base64 library by Adam Rudd
 	Link:
 		https://github.com/adamvr/arduino-base64
 
@@ -47,7 +47,6 @@
 #include <Arduino.h>
 #include <stdlib.h>
 #include <SoftwareSerial.h>
-#include <Base64.h>
 #include <util/crc16.h>
 
 
@@ -56,15 +55,138 @@
 #define MCACKCOUNT 10
 #define MCACKMINAMOUNT 6
 
-class MessageComLite {
-	private:
-		int indexOf(uint8_t*, uint8_t, uint8_t=0, uint8_t=0);
-		uint8_t extendDataTo(uint8_t);
-		void getPositionsOfIndexFromData(uint8_t, uint8_t&, int&, int&);
-		boolean bytePlausible(uint8_t);
-		void skipBytes(uint8_t);
+// latency trace: remove the comment to measure the stages of every message
+// #define MCTRACE
+
+// large frames: remove the comment to use 16-bit sizes for frames of up to 64 KB
+// for boards with enough RAM, both sides need the same setting
+// #define MCLARGEFRAMES
+
+// size of the regular header: version | type | commandStatus | messageNumber | totalQuantity | dataSize
+// large frames have their own version and 2 bytes for dataSize
+#ifdef MCLARGEFRAMES
+	typedef uint16_t MCSize;
+	#define MCSIZEBYTES 2
+	#define MCVERSION 3
+#else
+	typedef uint8_t MCSize;
+	#define MCSIZEBYTES 1
+	#define MCVERSION 2
+#endif
+#define MCHEADERSIZE (5+MCSIZEBYTES)
+// fields of a message, their indices are uint8_t: a large frame refuses the field behind the last one
+#define MCMAXFIELDS 255
+// position that is never reached in a frame
+#define MCNOPOS ((MCSize) ~0)
+
+// compact header, 1st byte: flags and type
+// the size byte is dropped, the fragment fields are only sent if they are used
+#define MCCOMPACT 0x80
+#define MCCOMPACTFRAGMENTS 0x40
+#define MCCOMPACTADDRESS 0x20
+#define MCCOMPACTTYPE 0x1F
+
+// addressing: the destination follows the 1st byte of a compact header
+// 1 to 127: a node, 128 to 254: a group, 255: all nodes, 0: no address
+#define MCGROUP 0x80
+#define MCBROADCAST 0xFF
+
+// link handshake: reserved message type and the task values of its two messages
+#define MCTYPELINK 0xFF
+#define MCLINKOFFER 1
+#define MCLINKREPLY 2
+// link features, exchanged as bitmask
+#define MCFEATCOMPACT 0x01
+#define MCFEATFLETCHER16 0x02
+#define MCFEATCRC32C 0x04
+#define MCFEATFEC 0x08
+#define MCFEATACKFRAME 0x10
+// checksum engines, CRC-16 (default), Fletcher-16 (cheapest on AVR), CRC-32C (hardware CRC on the host)
+#define MCCHECKCRC16 0
+#define MCCHECKFLETCHER16 1
+#define MCCHECKCRC32C 2
+// forward error correction: parity bytes per block of up to 255 bytes, MCFECPARITY/2 wrong bytes per block are corrected
+#define MCFECPARITY 8
+// a frame with parity ends with this char in front of the stop delimiter, only such a frame is corrected
+#define MCFECMARK '*'
+// acknowledgement in the frame: the last byte of a compact header without destination,
+// the low byte of the checksum of the acknowledged message, MCFRAMEACK if that byte is 0, 0: none
+#define MCFRAMEACK 1
+// non-blocking: ms a due acknowledgement waits for a message it can ride in
+#define MCACKDELAY (MCTIMER/2)
+// failed sends or garbled messages in a row until the link falls back
+#define MCLINKMAXFAIL 5
+// ms a negotiated link waits for a message or an acknowledgement of the peer it expects until it falls back,
+// an idle link stays up
+#define MCLINKSILENCE 10000
+
+// non-blocking: send states and events of poll()
+#define MCIDLE 0
+#define MCPENDING 1
+#define MCSENT 2
+#define MCFAILED 3
+#define MCRECEIVED 4
+// MCFAILED: no acknowledgement in time, MCREFUSED: the peer answered with NACK
+#define MCREFUSED 5
+
+// latency trace: stages and histogram buckets
+#define MCTRACEENCODE 0
+#define MCTRACETRANSMIT 1
+#define MCTRACEACK 2
+#define MCTRACERECEIVE 3
+#define MCTRACEAUTH 4
+#define MCTRACEGATHER 5
+#define MCTRACESTAGES 6
+#define MCTRACEBUCKETS 8
+
+#ifdef MCTRACE
+	#define MCTRACESTART(stage) traceStart(stage)
+	#define MCTRACESTOP(stage) traceStop(stage)
+#else
+	#define MCTRACESTART(stage)
+	#define MCTRACESTOP(stage)
+#endif
 
-		// POINTER
+// capture: the record directions, the file magic and the bytes per record
+#define MCCAPTURERX 0
+#define MCCAPTURETX 1
+#define MCCAPTUREMAGIC "MCC1"
+#define MCCAPTURECHUNK 16
+
+// queue: priority classes, a lower value is sent first
+#define MCPRIOCONTROL 1
+#define MCPRIONORMAL 2
+#define MCPRIOBULK 3
+// queue: bytes per slot in front of the buffer and the size of the whole queue array
+#define MCQUEUEHEADER (4+MCSIZEBYTES)
+#define MCQUEUESIZE(slots, bufferMaxSize) ((slots)*(MCQUEUEHEADER+(bufferMaxSize)))
+// receive queue: state of a slot with a verified message, result of a message without state flag
+#define MCQUEUEREADY 1
+#define MCQUEUENACK 2
+
+// dispatch: taskValue of a handler entry which matches every task of its type
+#define MCANYTASK 0xFF
+
+class MessageComLite;
+
+// a handler gets the received message with all header fields already gathered
+typedef void (*MCHandler)(MessageComLite&);
+
+// entry of the user defined handler table
+// the table has to be sorted by type and taskValue, e.g.:
+// const MCHandlerEntry handlers[] = { {1, 3, onLight}, {1, MCANYTASK, onType1}, {2, 0, onTemp} };
+struct MCHandlerEntry {
+	uint8_t type;
+	uint8_t taskValue;
+	MCHandler handler;
+};
+
+// a message: the user defined arrays and the build and parse state of one frame
+// MessageComLite works on its own message, swapMessage() exchanges it with another one,
+// e.g. to keep messages waiting for the port in a pool
+class MCMessage {
+	friend class MessageComLite;
+	private:
 		// pointer to extern buffer array
 		uint8_t* _buffer;
 		// pointer to extern msg array
@@ -73,39 +195,16 @@ class MessageComLite {
 		// pointer to data part of the message
 		uint8_t* _data;
 
-		// communication interfaces HW- or SW-Serial
-		HardwareSerial* _Serial;
-		SoftwareSerial* _swSerial;
-
-		// used for data extraction
-		uint8_t _dataCount;
-		uint8_t _nextData;
-
 		// maximum size of the whole buffer
-		uint8_t _bufferMaxSize;
+		MCSize _bufferMaxSize;
 		// maximum size of the whole message
-		uint8_t _maxSize;
-		// maximum size of the whole ack-message
-		uint8_t _ackMaxSize;
+		MCSize _maxSize;
 
 		// actual size of the whole message
-		uint8_t _size;
+		MCSize _size;
 
 		// actual size of the whole message (base64)
-		uint8_t _bufferSize;
-
-		// Start & Stop sign
-		// char _authDelimiter;
-		char _startDelimiter;
-		char _stopDelimiter;
-
-		// data delimiter
-		char _delimiter;
-
-		// ack sign
-		char _ackChar;
-		// nack sign
-		char _nackChar;
+		MCSize _bufferSize;
 
 		// identification
 		uint8_t _version;
@@ -119,17 +218,331 @@ class MessageComLite {
 		uint8_t _totalQuantity;
 
 		// actual size of the "_data array"
-		uint8_t _dataSize;
+		MCSize _dataSize;
+
+		// used for data extraction
+		uint8_t _dataCount;
+		uint8_t _nextData;
 
-		// checksum
-		uint16_t _checksum;
+		// the header always ends in front of _data, the frame starts at _msg[_frameStart]
+		uint8_t _headerSize;
+		uint8_t _frameStart;
+
+		// destination of the sent and of the received message
+		uint8_t _destination;
+		uint8_t _recvDestination;
+		// the last message was addressed to another node
+		boolean _foreign;
+
+		// non-blocking: position in _buffer of the message being received
+		MCSize _recvPos;
+
+		// template: the encoded message in _buffer is valid
+		boolean _templateValid;
+		// changed bytes, counted from the frame start
+		MCSize _dirtyFrom;
+		MCSize _dirtyTo;
+		// checksum state in front of the byte _crcPos
+		MCSize _crcPos;
+		uint32_t _crcCache;
+
+		// checksum: engine and size of the message in _msg
+		uint8_t _msgCheck;
+		uint8_t _checkSize;
+		uint32_t _checksum;
 		uint8_t _csH;
 		uint8_t _csL;
+		// forward error correction: parity bytes behind the checksum of the message in _msg
+		MCSize _paritySize;
+	public:
+		MCMessage(uint8_t*, MCSize, uint8_t*, MCSize);
+		// without arrays, e.g. for an array of messages that are moved in later
+		MCMessage();
+		// a message is moved, never copied: the source keeps no arrays
+		MCMessage(MCMessage&&);
+		MCMessage& operator=(MCMessage&&);
+		MCMessage(const MCMessage&) = delete;
+		MCMessage& operator=(const MCMessage&) = delete;
+};
+
+class MessageComLite : private MCMessage {
+	private:
+		int indexOf(uint8_t*, uint8_t, MCSize=0, MCSize=0);
+		MCSize getDataSpace();
+		uint8_t extendDataTo(MCSize);
+		boolean isArrayAt(MCSize);
+		MCSize getArrayEndAt(MCSize);
+		void getPositionsOfIndexFromData(uint8_t, MCSize&, int&, int&);
+		MCSize addArrayField(MCSize);
+		boolean bytePlausible(uint8_t);
+		boolean byteInFrame(uint8_t);
+		void skipBytes(MCSize);
+		boolean skipEcho(uint8_t);
+		void waitEcho(MCSize);
+		unsigned long wireTime(MCSize);
+		uint8_t compactHeaderSize(uint8_t);
+
+		// addressing
+		uint8_t getDestinationFrom(uint8_t*);
+		MCSize getSizeFrom(uint8_t*);
+		boolean addressedToMe(uint8_t);
+
+		// base64
+		void base64EncodeGroup(uint8_t*, uint8_t*, MCSize);
+		uint8_t base64DecodeQuad(uint8_t*, uint8_t*);
+		MCSize base64Encode(uint8_t*, uint8_t*, MCSize);
+		MCSize base64Decode(uint8_t*, uint8_t*, MCSize);
+
+		// transport
+		int available();
+		int readByte();
+		void writeByte(uint8_t);
+
+		// queue
+		uint8_t* getQueueSlot(uint8_t*, uint8_t);
+		MCSize getSlotSize(uint8_t*);
+		void setSlotSize(uint8_t*, MCSize);
+
+		// receive queue
+		void queueByte(uint8_t);
+		uint8_t checkQueued(uint8_t*, MCSize);
+
+		// link
+		boolean createLinkMessage(uint8_t);
+		boolean readLinkMessage(MCSize&, uint8_t&, unsigned long&);
+		void useLink(MCSize, uint8_t, unsigned long);
+		void setBaud(unsigned long);
+		void linkFailed();
+		void linkSilent();
+		void awaitLife();
+
+		// checksum engines
+		uint8_t checkOf(uint8_t);
+		uint8_t checkSizeOf(uint8_t);
+		void useCheck(uint8_t);
+		uint32_t checksumStart(uint8_t);
+		uint32_t checksumUpdate(uint8_t, uint32_t, uint8_t*, MCSize);
+		uint32_t checksumFinish(uint8_t, uint32_t);
+		uint32_t crc32cUpdate(uint32_t, uint8_t*, MCSize);
+		uint32_t readChecksum(uint8_t*, uint8_t);
+		void writeChecksum(uint8_t*);
+
+		// forward error correction
+		uint8_t fecMul(uint8_t, uint8_t);
+		uint8_t fecInv(uint8_t);
+		MCSize fecParityOf(MCSize);
+		MCSize fecEncode(uint8_t*, MCSize);
+		boolean fecCorrectBlock(uint8_t*, MCSize, uint8_t*);
+		MCSize fecCorrect(uint8_t*, MCSize);
+
+#ifdef MCTRACE
+		// trace
+		void traceStart(uint8_t);
+		void traceStop(uint8_t);
+#endif
+
+		// template
+		void markDirty(MCSize);
+		boolean updateDataBytes(uint8_t, uint8_t*, uint8_t);
+		void updateTemplate();
+
+		// non-blocking
+		boolean parseByte(uint8_t);
+		boolean answer(boolean=0);
+
+		// acknowledgement in the frame
+		void carryAck(uint8_t);
+		void flushAck();
+		uint8_t getFrameAck();
+
+		// dispatch
+		int findHandler(uint8_t, uint8_t);
+
+		// capture
+		void captureByte(uint8_t, uint8_t);
+		void captureFlush();
+
+		// communication interfaces HW- or SW-Serial
+		HardwareSerial* _Serial;
+		SoftwareSerial* _swSerial;
+
+		// capture of the raw traffic
+		// records are collected in a small chunk to keep the log compact
+		Print* _capture;
+		uint8_t _captureChunk[MCCAPTURECHUNK];
+		uint8_t _captureSize;
+		uint8_t _captureDirection;
+		unsigned long _captureTime;
+
+		// pointer to extern queue array for outgoing messages
+		uint8_t* _queue;
+		uint8_t _queueSlots;
+		uint8_t _queueOrder;
+
+		// pointer to extern queue array for messages received while waiting for an acknowledgement
+		uint8_t* _rxQueue;
+		uint8_t _rxSlots;
+		uint8_t _rxOrder;
+		// slot and position of the message being received, 0xFF: none
+		uint8_t _rxSlot;
+		MCSize _rxPos;
+
+		// addressing: own node and group address
+		uint8_t _address;
+		uint8_t _group;
+
+		// pointer to extern handler table
+		const MCHandlerEntry* _handlers;
+		uint8_t _handlerCount;
+
+		// maximum size of the whole ack-message
+		MCSize _ackMaxSize;
+
+		// Start & Stop sign
+		// char _authDelimiter;
+		char _startDelimiter;
+		char _stopDelimiter;
+
+		// data delimiter
+		char _delimiter;
+
+		// ack sign
+		char _ackChar;
+		// nack sign
+		char _nackChar;
+
+		// header format
+		boolean _compact;
+
+		// link: baud rates, supported and negotiated features
+		unsigned long _baseBaud;
+		unsigned long _maxBaud;
+		unsigned long _baud;
+		uint8_t _features;
+		uint8_t _linkFeatures;
+		MCSize _linkMaxSize;
+		uint8_t _failCount;
+		unsigned long _lastLife;
+		// a sent message waits for an acknowledgement since _lastLife
+		boolean _awaitLife;
+
+		// non-blocking: the sent message waiting for its acknowledgement
+		uint8_t _sendState;
+		uint8_t _ackCount;
+		uint8_t _nackCount;
+		// the last sent message and the position of its expected echo
+		uint8_t *_echoFrame;
+		MCSize _echoSize;
+		MCSize _echoPos;
+		unsigned long _sendStart;
+		unsigned long _sendTimeout;
+		// the message goes to a group or to all nodes: sent once its echo is back
+		boolean _sendSilent;
+
+		// template: the encoded message in _buffer is kept and only changed bytes are encoded again
+		boolean _template;
+
+#ifdef MCTRACE
+		// latency trace: start time of the running stages, histograms and total time per stage
+		unsigned long _traceStart[MCTRACESTAGES];
+		uint8_t _traceRunning;
+		uint16_t _traceHist[MCTRACESTAGES][MCTRACEBUCKETS];
+		unsigned long _traceSum[MCTRACESTAGES];
+#endif
+
+		// checksum engine of the link
+		uint8_t _check;
+		// forward error correction: on or off
+		boolean _fec;
+		// acknowledgement in the frame: on or off, a due acknowledgement and its value,
+		// the one received in a message of the peer, the one that acknowledges the sent message
+		boolean _ackFrame;
+		boolean _ackDue;
+		unsigned long _ackDueSince;
+		uint8_t _ackValue;
+		uint8_t _recvAck;
+		uint8_t _sendAck;
+		// half-duplex: the line echoes, echoes of the own acknowledgements still to come
+		boolean _echoLine;
+		uint8_t _echoAcks;
+		uint8_t _echoNacks;
 	public:
-		MessageComLite(HardwareSerial&, uint8_t*, uint8_t, uint8_t*, uint8_t);
-		MessageComLite(SoftwareSerial&, uint8_t*, uint8_t, uint8_t*, uint8_t);
+		MessageComLite(HardwareSerial&, uint8_t*, MCSize, uint8_t*, MCSize);
+		MessageComLite(SoftwareSerial&, uint8_t*, MCSize, uint8_t*, MCSize);
+
+		// exchange the own message with another one of the same array sizes
+		boolean swapMessage(MCMessage&);
+
+		MCSize getSize();
+
+		// send small messages with the compact header
+		void setCompactHeader(boolean);
+
+		// checksum engine, offered in the link handshake
+		void setChecksumEngine(uint8_t);
+		uint8_t getChecksumEngine();
+
+		// forward error correction, offered in the link handshake
+		void setErrorCorrection(boolean);
+		boolean getErrorCorrection();
+
+		// acknowledgements ride in compact messages, offered in the link handshake, needs the receive queue
+		void setAckInFrame(boolean);
+		boolean getAckInFrame();
+
+		// link handshake: negotiate baud, frame size and features with the peer
+		void setLink(unsigned long, unsigned long);
+		boolean linkUp();
+		void linkDown();
+		unsigned long getBaud();
+		MCSize getLinkMaxSize();
+		uint8_t getLinkFeatures();
+
+		// template: periodic messages of the same layout
+		void setTemplate(boolean);
+		boolean updateData(uint8_t, uint8_t);
+		boolean updateData(uint8_t, char);
+		boolean updateData(uint8_t, uint16_t);
+		boolean updateData(uint8_t, int);
+		boolean updateData(uint8_t, long);
+		boolean updateData(uint8_t, unsigned long);
+
+#ifdef MCTRACE
+		// latency trace
+		void clearTrace();
+		void dumpTrace(Print&);
+#endif
 
-		uint8_t getSize();
+		// non-blocking communication for a loop that must not wait
+		uint8_t poll();
+		boolean sendAsync(unsigned long=(MCTIMER*MCMAXTRY));
+		void cancel();
+		uint8_t getSendState();
+
+		// capture raw RX/TX bytes with timestamps into a binary log
+		void setCapture(Print&);
+		void stopCapture();
+
+		// priority queue for outgoing messages
+		void setQueue(uint8_t*, uint8_t);
+		boolean enqueue(uint8_t=MCPRIONORMAL);
+		uint8_t getQueueCount();
+		boolean sendQueued();
+
+		// receive queue: full-duplex, messages of the peer are kept while waiting for an acknowledgement
+		void setRxQueue(uint8_t*, uint8_t);
+		boolean recvQueued();
+
+		// addressing on a bus: messages to other nodes are skipped before they are decoded
+		void setAddress(uint8_t);
+		void setGroup(uint8_t);
+		// only the types up to MCCOMPACTTYPE can be addressed, createMessage() refuses the others
+		void setDestination(uint8_t);
+		uint8_t getRecvDestination();
+
+		// dispatch of received messages to handlers by type and task value
+		void setHandlers(const MCHandlerEntry*, uint8_t);
+		boolean dispatch();
 
 		// clean up the message ... reset values
 		void clear();
@@ -139,6 +552,7 @@ class MessageComLite {
 		void getTypeFromMessage();
 		void setVersion(uint8_t);
 		void setType(uint8_t);
+		uint8_t getType();
 
 
 		// Command Status methods
@@ -158,7 +572,7 @@ class MessageComLite {
 
 		// DataSize methods
 		void getDataSizeFromMessage();
-		void setDataSize(uint8_t);
+		void setDataSize(MCSize);
 
 		// Data methods
 		void getDataFromMessage();
@@ -171,6 +585,11 @@ class MessageComLite {
 		boolean addToData(long);
 		boolean addToData(unsigned long);
 
+		// bulk data methods: a whole array is stored as one field
+		boolean addArrayToData(const uint8_t*, MCSize);
+		boolean addArrayToData(const int16_t*, MCSize);
+		boolean addArrayToData(const uint16_t*, MCSize);
+
 		uint8_t getUint8FromData(uint8_t);
 		char* getCharArrayFromData(uint8_t);
 		char getCharFromData(uint8_t);
@@ -178,6 +597,10 @@ class MessageComLite {
 		int getIntFromData(uint8_t);
 		long getLongFromData(uint8_t);
 		unsigned long getUnsignedLongFromData(uint8_t);
+
+		MCSize getArrayFromData(uint8_t, uint8_t*, MCSize);
+		MCSize getArrayFromData(uint8_t, int16_t*, MCSize);
+		MCSize getArrayFromData(uint8_t, uint16_t*, MCSize);
 		
 		// data pointing methods
 		uint8_t getDataCount();
@@ -190,12 +613,12 @@ class MessageComLite {
 		void getCsHFromMessage();
 		void getCsLFromMessage();
 		void getChecksumFromMessage();
-		uint16_t getChecksumFrom(uint8_t*, uint8_t=0);
-		uint16_t makeCrcFrom(uint8_t*, uint8_t=0);
+		uint32_t getChecksumFrom(uint8_t*, MCSize=0);
+		uint32_t makeCrcFrom(uint8_t*, MCSize=0);
 		void setCrc();
 		void getCrcLH(uint16_t);
 		boolean crcOk();
-		boolean crcOk(uint8_t*, uint8_t=0);
+		boolean crcOk(uint8_t*, MCSize=0);
 
 		// modeling and extraction methods
 		void gatherInfoFromMessage();
@@ -207,11 +630,12 @@ class MessageComLite {
 		boolean authMsg(uint8_t*);
 		boolean readMsg(uint8_t*);
 
-		boolean recv(uint8_t=MCMAXTRY, unsigned long=MCTIMER, uint8_t=0);
-		boolean receiveAck(uint8_t);
+		boolean recv(uint8_t=MCMAXTRY, unsigned long=MCTIMER, MCSize=0);
+		boolean receiveAck(MCSize);
 		boolean receive(uint8_t=MCMAXTRY, unsigned long=MCTIMER);
 
-		uint8_t snd();
+		MCSize snd();
+		MCSize sndFrom(uint8_t*, MCSize);
 		void sendAck(boolean);
 		boolean send();
 };
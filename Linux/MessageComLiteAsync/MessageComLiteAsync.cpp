@@ -0,0 +1,266 @@
+/*
+	MessageComLiteAsync.cpp
+
+	Coroutines on top of the non-blocking part of MessageComLite for Linux,
+	see MessageComLiteAsync.h.
+
+	@version 0.5
+
+	@link https://github.com/sigger/MessageComLite
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <exception>
+#include <poll.h>
+
+#include "MessageComLiteAsync.h"
+
+// task
+MCTask MCTask::promise_type::get_return_object() {
+	return MCTask(std::coroutine_handle<promise_type>::from_promise(*this));
+}
+void MCTask::promise_type::unhandled_exception() {
+	// a conversation must not take the loop down with it silently
+	std::terminate();
+}
+MCTask::MCTask(std::coroutine_handle<promise_type> handle) {
+	_handle = handle;
+}
+
+// send
+MCSendOp::MCSendOp(MCLink &link, MCMessage &message, uint8_t taskValue, boolean state, unsigned long timeout, MCCancel *cancel)
+	: _link(link), _message(message) {
+	_taskValue = taskValue;
+	_state = state;
+	_timeout = timeout;
+	_cancel = cancel;
+	_result = MCIDLE;
+}
+bool MCSendOp::await_suspend(std::coroutine_handle<> handle) {
+	_handle = handle;
+	_link.takeComposed(_message);
+	_link._senders.push_back(this);
+	// the line is free: send at once, a refused message does not wait at all
+	if(!_link._sending && _link._senders.front() == this && !_link.startSend()) {
+		_link._senders.pop_front();
+		return false;
+	}
+	return true;
+}
+
+// receive
+MCRecvOp::MCRecvOp(MCLink &link, unsigned long timeout, MCCancel *cancel)
+	: _link(link) {
+	_start = 0;
+	_timeout = timeout;
+	_cancel = cancel;
+	_result = 0;
+}
+void MCRecvOp::await_suspend(std::coroutine_handle<> handle) {
+	_handle = handle;
+	_start = millis();
+	_link._receivers.push_back(this);
+}
+
+// link
+MCLink::MCLink(MCLoop &loop, HardwareSerial &serial, MessageComLite &mc, MCSize bufferMaxSize, MCSize maxSize)
+	: _loop(loop), _mc(mc), _serial(serial), _builderSerial("/dev/null") {
+	// the arrays travel between the messages, authMsg() looks at one byte past the buffer
+	_builderBuffer = new uint8_t[(bufferMaxSize+1)]();
+	_builderMsg = new uint8_t[maxSize];
+	_builder = new MessageComLite(_builderSerial, _builderBuffer, bufferMaxSize, _builderMsg, maxSize);
+	_composed = nullptr;
+	_sending = 0;
+	_loop._links.push_back(this);
+}
+MCLink::~MCLink() {
+	for(size_t i=0; i<_loop._links.size(); i++) {
+		if(_loop._links[i] == this) {
+			_loop._links.erase((_loop._links.begin()+i));
+			break;
+		}
+	}
+	// a composed message gets its arrays back before the builder goes
+	if(_composed != nullptr)
+		_builder->swapMessage(*_composed);
+	delete _builder;
+	delete[] _builderBuffer;
+	delete[] _builderMsg;
+}
+MessageComLite& MCLink::mc() {
+	return _mc;
+}
+MessageComLite& MCLink::compose(MCMessage &message) {
+	// the message composed before goes back to its owner
+	if(_composed != nullptr)
+		_builder->swapMessage(*_composed);
+	_composed = nullptr;
+	// the room for the data depends on the checksum and the parity of the link
+	_builder->setChecksumEngine(_mc.getChecksumEngine());
+	_builder->setErrorCorrection(_mc.getErrorCorrection());
+	if(_builder->swapMessage(message))
+		_composed = &message;
+	_builder->clear();
+	return *_builder;
+}
+void MCLink::takeComposed(MCMessage &message) {
+	if(_composed != &message)
+		return;
+	_builder->swapMessage(message);
+	_composed = nullptr;
+}
+MCSendOp MCLink::send(MCMessage &message, uint8_t taskValue, boolean state, unsigned long timeout, MCCancel *cancel) {
+	return MCSendOp(*this, message, taskValue, state, timeout, cancel);
+}
+MCRecvOp MCLink::receive(unsigned long timeout, MCCancel *cancel) {
+	return MCRecvOp(*this, timeout, cancel);
+}
+void MCLink::cancel() {
+	if(_sending) {
+		_mc.cancel();
+		endSend(MCIDLE);
+	}
+	// the resumed coroutines may already wait again, those stay
+	std::deque<MCSendOp*> senders;
+	senders.swap(_senders);
+	for(MCSendOp *op : senders) {
+		op->_result = MCIDLE;
+		op->_handle.resume();
+	}
+	std::deque<MCRecvOp*> receivers;
+	receivers.swap(_receivers);
+	for(MCRecvOp *op : receivers)
+		endReceive(op, 0);
+}
+boolean MCLink::startSend() {
+	// returns 0 if the first send already ended, its result is set then
+	MCSendOp *op = _senders.front();
+	// the MessageComLite still waits for a message sent without the link
+	if(_mc.getSendState() == MCPENDING)
+		return 1;
+	// the link lends its arrays to the message of the send until it ended
+	if(!_mc.swapMessage(op->_message)) {
+		op->_result = MCIDLE;
+		return 0;
+	}
+	_mc.createMessage(op->_taskValue, op->_state);
+	if(!_mc.sendAsync(op->_timeout)) {
+		_mc.swapMessage(op->_message);
+		op->_result = MCIDLE;
+		return 0;
+	}
+	_sending = 1;
+	return 1;
+}
+void MCLink::endSend(uint8_t event) {
+	MCSendOp *op = _senders.front();
+	_senders.pop_front();
+	_sending = 0;
+	// the message goes back to the coroutine, the link gets its own arrays again
+	_mc.swapMessage(op->_message);
+	op->_result = event;
+	op->_handle.resume();
+}
+void MCLink::endReceive(MCRecvOp *op, boolean received) {
+	op->_result = received;
+	op->_handle.resume();
+}
+void MCLink::serve() {
+	uint8_t event;
+	while((event = _mc.poll()) != MCIDLE) {
+		if(event == MCRECEIVED) {
+			// the oldest receive() takes it, without one the handlers of the MessageComLite do
+			if(_receivers.empty()) {
+				_mc.dispatch();
+			} else {
+				MCRecvOp *op = _receivers.front();
+				_receivers.pop_front();
+				endReceive(op, 1);
+			}
+		} else if(_sending) {
+			endSend(event);
+		}
+	}
+
+	// cancelled or timed out, the resumed coroutines may change the lines
+	unsigned long now = millis();
+	for(size_t i=0; i<_receivers.size(); ) {
+		MCRecvOp *op = _receivers[i];
+		if((op->_cancel != nullptr && op->_cancel->cancelled) || (now-op->_start) >= op->_timeout) {
+			_receivers.erase((_receivers.begin()+i));
+			endReceive(op, 0);
+		} else {
+			i++;
+		}
+	}
+	for(size_t i=0; i<_senders.size(); ) {
+		MCSendOp *op = _senders[i];
+		if(op->_cancel == nullptr || !op->_cancel->cancelled) {
+			i++;
+		} else if(i == 0 && _sending) {
+			_mc.cancel();
+			endSend(MCIDLE);
+		} else {
+			_senders.erase((_senders.begin()+i));
+			op->_result = MCIDLE;
+			op->_handle.resume();
+		}
+	}
+
+	// the next send in line
+	while(!_sending && !_senders.empty()) {
+		if(startSend())
+			break;
+		MCSendOp *op = _senders.front();
+		_senders.pop_front();
+		op->_handle.resume();
+	}
+}
+
+// loop
+MCLoop::~MCLoop() {
+	for(auto handle : _tasks)
+		handle.destroy();
+}
+void MCLoop::spawn(MCTask task) {
+	_tasks.push_back(task._handle);
+	task._handle.resume();
+}
+void MCLoop::step() {
+	// wait for bytes from any port, but not longer than MCTIMER, for the timeouts
+	std::vector<struct pollfd> fds(_links.size());
+	for(size_t i=0; i<_links.size(); i++) {
+		fds[i].fd = _links[i]->_serial.getFd();
+		fds[i].events = POLLIN;
+	}
+	poll(fds.data(), fds.size(), MCTIMER);
+	// by index, a resumed coroutine may add or remove links
+	for(size_t i=0; i<_links.size(); i++)
+		_links[i]->serve();
+}
+void MCLoop::run() {
+	while(!_tasks.empty()) {
+		step();
+		for(size_t i=0; i<_tasks.size(); ) {
+			if(_tasks[i].done()) {
+				_tasks[i].destroy();
+				_tasks.erase((_tasks.begin()+i));
+			} else {
+				i++;
+			}
+		}
+	}
+}
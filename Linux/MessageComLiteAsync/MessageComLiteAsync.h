@@ -0,0 +1,187 @@
+/*
+	MessageComLiteAsync.h
+
+	Coroutines on top of the non-blocking part of MessageComLite for Linux.
+	A conversation with a node is a coroutine that awaits send() and receive() of its link,
+	the event loop runs sendAsync() and poll() of every link and resumes the coroutines,
+	so many conversations share one thread without callbacks or a thread per port.
+	A loop and its links belong to one thread, a few threads run a few loops.
+
+	Build with C++20, the headers of the gateway stand in for the Arduino core:
+		g++ -std=c++20 -O2 -I../MessageComLiteGateway -I../../Arduino/MessageComLite \
+			../MessageComLiteGateway/Arduino.cpp ../../Arduino/MessageComLite/MessageComLite.cpp \
+			MessageComLiteAsync.cpp <program>.cpp
+
+	Example:
+		MCTask talk(MCLink &link, MCMessage &message) {
+			MessageComLite &mc = link.compose(message);
+			mc.setType(3);
+			mc.addToData((int) 42);
+			if(co_await link.send(message, 1, 1) == MCSENT && co_await link.receive(1000))
+				printf("answer %u\n", link.mc().getType());
+		}
+		MCLoop loop;
+		MCLink link(loop, serial, mc, 255, 186);
+		loop.spawn(talk(link, message));
+		loop.run();
+
+	@version 0.5
+
+	@link https://github.com/sigger/MessageComLite
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef MessageComLiteAsync_h
+#define MessageComLiteAsync_h
+
+#include <coroutine>
+#include <deque>
+#include <vector>
+
+#include <MessageComLite.h>
+
+class MCLoop;
+class MCLink;
+
+// a conversation: a coroutine that returns nothing, the loop runs it
+class MCTask {
+	public:
+		struct promise_type {
+			MCTask get_return_object();
+			// the loop starts it in spawn() and destroys it when it is done
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			std::suspend_always final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception();
+		};
+		explicit MCTask(std::coroutine_handle<promise_type>);
+	private:
+		friend class MCLoop;
+		std::coroutine_handle<promise_type> _handle;
+};
+
+// cancellation of a waiting send() or receive(), checked by the loop
+struct MCCancel {
+	bool cancelled = false;
+	void cancel() { cancelled = true; }
+};
+
+// a waiting send()
+// result: MCSENT, MCFAILED, MCREFUSED or MCIDLE if the message was not sent or the send was cancelled
+class MCSendOp {
+	public:
+		MCSendOp(MCLink&, MCMessage&, uint8_t, boolean, unsigned long, MCCancel*);
+		bool await_ready() { return false; }
+		bool await_suspend(std::coroutine_handle<>);
+		uint8_t await_resume() { return _result; }
+	private:
+		friend class MCLink;
+		MCLink &_link;
+		MCMessage &_message;
+		uint8_t _taskValue;
+		boolean _state;
+		unsigned long _timeout;
+		MCCancel *_cancel;
+		uint8_t _result;
+		std::coroutine_handle<> _handle;
+};
+
+// a waiting receive()
+// result: 1 if a message was received, it stays in the MessageComLite of the link until the next await,
+// 0 after the timeout or if the receive was cancelled
+class MCRecvOp {
+	public:
+		MCRecvOp(MCLink&, unsigned long, MCCancel*);
+		bool await_ready() { return false; }
+		void await_suspend(std::coroutine_handle<>);
+		boolean await_resume() { return _result; }
+	private:
+		friend class MCLink;
+		MCLink &_link;
+		unsigned long _start;
+		unsigned long _timeout;
+		MCCancel *_cancel;
+		boolean _result;
+		std::coroutine_handle<> _handle;
+};
+
+// a port: one MessageComLite, the sends wait in line, the received messages go to the oldest receive()
+class MCLink {
+	public:
+		// the sizes are those of the arrays of the MessageComLite, the builder of compose() gets the same
+		MCLink(MCLoop&, HardwareSerial&, MessageComLite&, MCSize, MCSize);
+		~MCLink();
+
+		MessageComLite& mc();
+		// the builder holds the message to fill it, send() takes it back
+		MessageComLite& compose(MCMessage&);
+
+		// send the message with the settings of the link, ms until MCFAILED
+		MCSendOp send(MCMessage&, uint8_t, boolean, unsigned long=(MCTIMER*MCMAXTRY), MCCancel* =nullptr);
+		// the next received message, ms until the receive gives up
+		MCRecvOp receive(unsigned long, MCCancel* =nullptr);
+		// end every waiting send() and receive() with MCIDLE and 0
+		void cancel();
+
+	private:
+		friend class MCLoop;
+		friend class MCSendOp;
+		friend class MCRecvOp;
+
+		// handle the received bytes, resume the coroutines whose send() or receive() ended
+		void serve();
+		boolean startSend();
+		void endSend(uint8_t);
+		void endReceive(MCRecvOp*, boolean);
+		void takeComposed(MCMessage&);
+
+		MCLoop &_loop;
+		MessageComLite &_mc;
+		HardwareSerial &_serial;
+
+		// builder of compose(), it has no port
+		HardwareSerial _builderSerial;
+		uint8_t *_builderBuffer;
+		uint8_t *_builderMsg;
+		MessageComLite *_builder;
+		MCMessage *_composed;
+
+		// the first send is the one on the line once _sending is set
+		std::deque<MCSendOp*> _senders;
+		boolean _sending;
+		std::deque<MCRecvOp*> _receivers;
+};
+
+// the event loop of one thread
+class MCLoop {
+	public:
+		~MCLoop();
+
+		// start the conversation, it runs until its first await
+		void spawn(MCTask);
+		// one round: wait up to MCTIMER for a port, then serve every link
+		void step();
+		// step until every conversation is done
+		void run();
+
+	private:
+		friend class MCLink;
+
+		std::vector<MCLink*> _links;
+		std::vector<std::coroutine_handle<MCTask::promise_type>> _tasks;
+};
+
+#endif
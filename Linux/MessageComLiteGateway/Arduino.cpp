@@ -0,0 +1,187 @@
+/*
+	Arduino.cpp
+
+	The part of the Arduino core that MessageComLite uses, for Linux.
+
+	@version 0.5
+
+	@link https://github.com/sigger/MessageComLite
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+
+// timing
+static unsigned long long monotonicMicros() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (((unsigned long long) now.tv_sec*1000000ULL)+(now.tv_nsec/1000));
+}
+// like on the Arduino the time starts with the program
+static const unsigned long long startMicros = monotonicMicros();
+
+unsigned long millis() {
+	return (unsigned long) ((monotonicMicros()-startMicros)/1000);
+}
+unsigned long micros() {
+	return (unsigned long) (monotonicMicros()-startMicros);
+}
+void delay(unsigned long ms) {
+	struct timespec wait;
+	wait.tv_sec = (ms/1000);
+	wait.tv_nsec = ((long) (ms%1000)*1000000L);
+	while(nanosleep(&wait, &wait) != 0 && errno == EINTR);
+}
+
+// Print
+size_t Print::write(const uint8_t *buffer, size_t size) {
+	for(size_t i=0; i<size; i++)
+		write(buffer[i]);
+	return size;
+}
+size_t Print::print(const char *text) {
+	return write((const uint8_t*) text, strlen(text));
+}
+size_t Print::print(char value) {
+	return write((uint8_t) value);
+}
+size_t Print::print(unsigned int value) {
+	return print((unsigned long) value);
+}
+size_t Print::print(unsigned long value) {
+	char text[24];
+	snprintf(text, sizeof(text), "%lu", value);
+	return print(text);
+}
+size_t Print::println() {
+	return (print('\r')+print('\n'));
+}
+
+// HardwareSerial on a tty
+static speed_t speedOf(unsigned long baud) {
+	switch(baud) {
+		case 1200: return B1200;
+		case 2400: return B2400;
+		case 4800: return B4800;
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 500000: return B500000;
+		case 921600: return B921600;
+		case 1000000: return B1000000;
+		case 2000000: return B2000000;
+	}
+	return B0;
+}
+
+HardwareSerial::HardwareSerial(const char *path) {
+	_path = path;
+	_fd = -1;
+	_rxPos = 0;
+	_rxSize = 0;
+	_txSize = 0;
+}
+HardwareSerial::~HardwareSerial() {
+	end();
+}
+void HardwareSerial::begin(unsigned long baud) {
+	speed_t speed = speedOf(baud);
+	if(speed == B0)
+		return;
+	if(_fd < 0 && (_fd = open(_path, (O_RDWR | O_NOCTTY))) < 0)
+		return;
+
+	// raw bytes, read() returns at once with what is there, like on the Arduino
+	struct termios tty;
+	if(tcgetattr(_fd, &tty) != 0)
+		return;
+	cfmakeraw(&tty);
+	tty.c_cflag |= (CLOCAL | CREAD);
+	tty.c_cc[VMIN] = 0;
+	tty.c_cc[VTIME] = 0;
+	cfsetispeed(&tty, speed);
+	cfsetospeed(&tty, speed);
+	tcsetattr(_fd, TCSANOW, &tty);
+}
+void HardwareSerial::end() {
+	if(_fd < 0)
+		return;
+	flush();
+	close(_fd);
+	_fd = -1;
+}
+HardwareSerial::operator bool() {
+	return (_fd >= 0);
+}
+int HardwareSerial::getFd() {
+	return _fd;
+}
+
+int HardwareSerial::available() {
+	if(_rxPos == _rxSize && _fd >= 0) {
+		ssize_t got = ::read(_fd, _rx, sizeof(_rx));
+		_rxPos = 0;
+		_rxSize = ((got > 0) ? (size_t) got : 0);
+	}
+	return (int) (_rxSize-_rxPos);
+}
+int HardwareSerial::read() {
+	if(available() == 0)
+		return -1;
+	return _rx[_rxPos++];
+}
+int HardwareSerial::peek() {
+	if(available() == 0)
+		return -1;
+	return _rx[_rxPos];
+}
+size_t HardwareSerial::write(uint8_t value) {
+	if(_fd < 0)
+		return 0;
+	_tx[_txSize++] = value;
+	// every message and every acknowledgement ends with \r\n
+	if(value == '\n' || _txSize == sizeof(_tx))
+		flushTx();
+	return 1;
+}
+void HardwareSerial::flush() {
+	// like on the Arduino: wait until the bytes are sent
+	flushTx();
+	if(_fd >= 0)
+		tcdrain(_fd);
+}
+void HardwareSerial::flushTx() {
+	size_t pos = 0;
+	while(pos < _txSize && _fd >= 0) {
+		ssize_t put = ::write(_fd, &_tx[pos], (_txSize-pos));
+		if(put < 0 && errno != EINTR)
+			break;
+		if(put > 0)
+			pos += put;
+	}
+	_txSize = 0;
+}
@@ -0,0 +1,113 @@
+/*
+	Arduino.h
+
+	The part of the Arduino core that MessageComLite uses, for Linux.
+	It lets the Arduino library build on the host unchanged:
+	the Arduino types and macros, millis(), micros(), delay()
+	and a HardwareSerial that runs on a tty.
+
+	@version 0.5
+
+	@link https://github.com/sigger/MessageComLite
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+// the host has no separate program memory
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t*) (addr))
+#define pgm_read_word(addr) (*(const uint16_t*) (addr))
+#define pgm_read_dword(addr) (*(const uint32_t*) (addr))
+
+// a function instead of the macro of the Arduino core,
+// the C++ headers of the host undefine a macro min
+template<class T> inline T min(T a, T b) {
+	return ((a < b) ? a : b);
+}
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long);
+
+class Print {
+	public:
+		virtual ~Print() {}
+		virtual size_t write(uint8_t) = 0;
+		virtual size_t write(const uint8_t*, size_t);
+		virtual void flush() {}
+
+		size_t print(const char*);
+		size_t print(char);
+		size_t print(unsigned int);
+		size_t print(unsigned long);
+		size_t println();
+};
+
+class Stream : public Print {
+	public:
+		virtual int available() = 0;
+		virtual int read() = 0;
+		virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream {
+	private:
+		const char *_path;
+		int _fd;
+
+		// read and write whole blocks, one system call per byte is too slow
+		uint8_t _rx[256];
+		size_t _rxPos;
+		size_t _rxSize;
+		uint8_t _tx[256];
+		size_t _txSize;
+
+		void flushTx();
+	public:
+		HardwareSerial(const char*);
+		~HardwareSerial();
+
+		// the first call opens the tty, every call sets the baud rate
+		void begin(unsigned long);
+		void end();
+		// like Serial on the Arduino: false if the tty could not be opened
+		operator bool();
+		// the file descriptor to wait on in poll() or select()
+		int getFd();
+
+		int available();
+		int read();
+		int peek();
+		size_t write(uint8_t);
+		using Print::write;
+		void flush();
+};
+
+#endif
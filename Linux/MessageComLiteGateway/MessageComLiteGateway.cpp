@@ -0,0 +1,465 @@
+/*
+	MessageComLiteGateway.cpp
+
+	Gateway daemon for MessageComLite on Linux.
+	It owns the serial ports and runs the C++ library on them, so framing, checksum engines,
+	error correction, acknowledgements, addressing and the link handshake are the same as on the Arduino.
+	The received messages are published to local clients via a unix domain socket.
+	Clients send messages the same way, so a frontend only consumes results.
+
+	Build, the headers in this directory stand in for the Arduino core:
+		g++ -O2 -march=native -I. -I../../Arduino/MessageComLite -o MessageComLiteGateway \
+			Arduino.cpp ../../Arduino/MessageComLite/MessageComLite.cpp MessageComLiteGateway.cpp
+	add -DMCLARGEFRAMES if the nodes use large frames.
+
+	Usage:
+		MessageComLiteGateway [-c crc16|fletcher16|crc32c] [-e] [-a <address>] <socket> <port>[:<baud>[:<maxBaud>]] [...]
+	-c and -e choose the checksum engine and the error correction, the nodes need the same or linkUp().
+	-a is the address of the gateway on a bus. The base baud rate is 9600,
+	with a maxBaud the nodes can negotiate a faster link with linkUp().
+
+	Every port sends its messages in SEND order, so ACK, NACK and TIMEOUT of a port come in the order of SEND.
+	The messages waiting for the ports share a pool of MCGATEWAYREQUESTS messages, allocated once at start,
+	BUSY means the pool is full. SEND builds the message in the pool, a port swaps it in and encodes it
+	when it is sent, so the link the port negotiated decides the header, checksum and error correction of the frame.
+
+	Line format, one message per line, data fields as hex separated by ',' ('-' if there is no data):
+		gateway -> client:
+			MSG <port> <type> <taskValue> <fields>
+			ACK <port> | NACK <port> | TIMEOUT <port> | BUSY <port> | ERR <text>
+		client -> gateway:
+			SEND <port> <type> <taskValue> <state> <fields>
+	A field of SEND is sent as an array field, the getters of the Arduino library read it like any other field.
+	A SEND that does not fit into a message is answered with ERR.
+
+	@version 0.5
+
+	@link https://github.com/sigger/MessageComLite
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <MessageComLite.h>
+
+#define MCGATEWAYMAXPORTS 8
+#define MCGATEWAYMAXCLIENTS 32
+// messages waiting for the ports, all ports share them
+#define MCGATEWAYREQUESTS 1024
+#define MCGATEWAYNOREQUEST 0xFFFF
+// messages of the peer received while waiting for an acknowledgement
+#define MCGATEWAYRXSLOTS 4
+// encoded and decoded size of the longest message
+#ifdef MCLARGEFRAMES
+	#define MCGATEWAYFRAME 1024
+#else
+	#define MCGATEWAYFRAME 255
+#endif
+// the frame also holds '#', the parity mark, ';' and the NUL
+#define MCGATEWAYMSG (((MCGATEWAYFRAME-4)/4)*3)
+// a line holds every byte of a message as hex and a separator
+#define MCGATEWAYLINE (64+(3*MCGATEWAYMSG))
+#define MCGATEWAYBAUD 9600
+
+// a message of SEND waiting for its port, the fields are already in it
+struct MCRequest {
+	MCMessage message;
+	uint8_t taskValue;
+	boolean state;
+	// the next message of the same port, or of the free slots
+	uint16_t next;
+};
+
+struct MCPort {
+	const char *path;
+	HardwareSerial *serial;
+	MessageComLite *mc;
+	// the first arrays of the port, they go round with the messages of the pool
+	uint8_t buffer[MCGATEWAYFRAME];
+	uint8_t msg[MCGATEWAYMSG];
+	uint8_t rxQueue[MCQUEUESIZE(MCGATEWAYRXSLOTS, MCGATEWAYFRAME)];
+
+	// the waiting messages, oldest first
+	uint16_t queueHead;
+	uint16_t queueTail;
+};
+
+struct MCClient {
+	int fd;
+	char line[MCGATEWAYLINE];
+	size_t lineSize;
+};
+
+// pool of the waiting messages: only slot numbers move between the free list and the ports
+static MCRequest requests[MCGATEWAYREQUESTS];
+static uint8_t requestBuffers[MCGATEWAYREQUESTS][MCGATEWAYFRAME];
+static uint8_t requestMsgs[MCGATEWAYREQUESTS][MCGATEWAYMSG];
+static uint16_t freeRequest = MCGATEWAYNOREQUEST;
+
+// builds the messages of SEND, it has no port
+static HardwareSerial builderSerial("/dev/null");
+static uint8_t builderBuffer[MCGATEWAYFRAME];
+static uint8_t builderMsg[MCGATEWAYMSG];
+static MessageComLite builder(builderSerial, builderBuffer, MCGATEWAYFRAME, builderMsg, MCGATEWAYMSG);
+
+static MCPort ports[MCGATEWAYMAXPORTS];
+static uint8_t portCount = 0;
+static MCClient clients[MCGATEWAYMAXCLIENTS];
+static uint8_t clientCount = 0;
+static int server = -1;
+
+// clients
+static void publish(const char *line) {
+	// a client that does not read loses the line, it never blocks the ports
+	for(uint8_t i=0; i<clientCount; i++) {
+		send(clients[i].fd, line, strlen(line), MSG_NOSIGNAL | MSG_DONTWAIT);
+		send(clients[i].fd, "\n", 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+	}
+}
+static void publishPort(const char *event, MCPort &port) {
+	char line[MCGATEWAYLINE];
+	snprintf(line, sizeof(line), "%s %s", event, port.path);
+	publish(line);
+}
+static void publishMessage(MCPort &port) {
+	MessageComLite &mc = *port.mc;
+	char line[MCGATEWAYLINE];
+	int pos = snprintf(line, sizeof(line), "MSG %s %u %u ", port.path, mc.getType(), mc.getTaskValue());
+
+	// the hex of a message always fits behind a path of a sane length
+	if(pos < 0 || pos >= (MCGATEWAYLINE-(3*MCGATEWAYMSG)))
+		return;
+
+	uint8_t count = mc.getDataCount();
+	if(count == 0)
+		line[pos++] = '-';
+	for(uint8_t i=0; i<count; i++) {
+		uint8_t values[MCGATEWAYMSG];
+		MCSize size = mc.getArrayFromData(i, values, MCGATEWAYMSG);
+		if(i > 0)
+			line[pos++] = ',';
+		for(MCSize j=0; j<size; j++)
+			pos += snprintf(&line[pos], 3, "%02x", values[j]);
+	}
+	line[pos] = 0;
+	publish(line);
+}
+
+// pool
+static void initRequests() {
+	for(uint16_t i=0; i<MCGATEWAYREQUESTS; i++) {
+		requests[i].message = MCMessage(requestBuffers[i], MCGATEWAYFRAME, requestMsgs[i], MCGATEWAYMSG);
+		requests[i].next = ((i+1 < MCGATEWAYREQUESTS) ? (i+1) : MCGATEWAYNOREQUEST);
+	}
+	freeRequest = 0;
+}
+static uint16_t allocRequest() {
+	// MCGATEWAYNOREQUEST if the pool is full
+	uint16_t id = freeRequest;
+	if(id != MCGATEWAYNOREQUEST)
+		freeRequest = requests[id].next;
+	return id;
+}
+static void releaseRequest(uint16_t id) {
+	requests[id].next = freeRequest;
+	freeRequest = id;
+}
+
+// ports
+static MCPort* findPort(const char *path) {
+	for(uint8_t i=0; i<portCount; i++) {
+		if(strcmp(ports[i].path, path) == 0)
+			return &ports[i];
+	}
+	return NULL;
+}
+static void sendNext(MCPort &port) {
+	// the message is encoded only now, with the settings the link has at the moment
+	uint16_t id = port.queueHead;
+	MCRequest &request = requests[id];
+	port.queueHead = request.next;
+	if(port.queueHead == MCGATEWAYNOREQUEST)
+		port.queueTail = MCGATEWAYNOREQUEST;
+
+	// the port takes the message of the slot, its own arrays go to the slot and are free again
+	MessageComLite &mc = *port.mc;
+	boolean swapped = mc.swapMessage(request.message);
+	releaseRequest(id);
+	if(swapped)
+		mc.createMessage(request.taskValue, request.state);
+	// a link that negotiated smaller frames can not carry it
+	// poll() reports a message to a group or to all nodes as sent once its echo is skipped
+	if(!swapped || mc.getSize() > mc.getLinkMaxSize() || !mc.sendAsync())
+		publishPort("NACK", port);
+}
+static void servePort(MCPort &port) {
+	MessageComLite &mc = *port.mc;
+	uint8_t event;
+	while((event = mc.poll()) != MCIDLE) {
+		if(event == MCRECEIVED) {
+			// a handshake message received while waiting for an acknowledgement is no message of the node
+			if(mc.getType() != MCTYPELINK)
+				publishMessage(port);
+		} else if(event == MCSENT) {
+			publishPort("ACK", port);
+		} else if(event == MCREFUSED) {
+			publishPort("NACK", port);
+		} else if(event == MCFAILED) {
+			publishPort("TIMEOUT", port);
+		}
+	}
+	if(mc.getSendState() != MCPENDING && port.queueHead != MCGATEWAYNOREQUEST)
+		sendNext(port);
+}
+
+// SEND <port> <type> <taskValue> <state> <fields>
+static int hexValue(char c) {
+	if(c >= '0' && c <= '9')
+		return (c-'0');
+	if(c >= 'a' && c <= 'f')
+		return (c-'a'+10);
+	if(c >= 'A' && c <= 'F')
+		return (c-'A'+10);
+	return -1;
+}
+static boolean parseFields(char *text, MessageComLite &mc) {
+	if(strcmp(text, "-") == 0)
+		return 1;
+
+	char *save = NULL;
+	for(char *field=strtok_r(text, ",", &save); field!=NULL; field=strtok_r(NULL, ",", &save)) {
+		size_t len = strlen(field);
+		if((len % 2) != 0 || (len/2) > MCGATEWAYMSG)
+			return 0;
+		uint8_t values[MCGATEWAYMSG];
+		for(size_t i=0; i<len; i+=2) {
+			int hi = hexValue(field[i]), lo = hexValue(field[(i+1)]);
+			if(hi < 0 || lo < 0)
+				return 0;
+			values[(i/2)] = (uint8_t) ((hi << 4) | lo);
+		}
+		if(!mc.addArrayToData(values, (MCSize) (len/2)))
+			return 0;
+	}
+	return 1;
+}
+static void sendFromLine(char *line) {
+	char copy[MCGATEWAYLINE];
+	snprintf(copy, sizeof(copy), "ERR %s", line);
+
+	char *args[6];
+	uint8_t count = 0;
+	char *save = NULL;
+	for(char *arg=strtok_r(line, " ", &save); arg!=NULL && count<6; arg=strtok_r(NULL, " ", &save))
+		args[count++] = arg;
+	MCPort *port = ((count == 6 && strcmp(args[0], "SEND") == 0) ? findPort(args[1]) : NULL);
+	if(port == NULL) {
+		publish(copy);
+		return;
+	}
+	uint16_t id = allocRequest();
+	if(id == MCGATEWAYNOREQUEST) {
+		publishPort("BUSY", *port);
+		return;
+	}
+
+	MCRequest &request = requests[id];
+	request.taskValue = (uint8_t) atoi(args[3]);
+	request.state = (atoi(args[4]) != 0);
+	// the builder fills the message of the slot and gives it back
+	builder.swapMessage(request.message);
+	builder.clear();
+	builder.setType((uint8_t) atoi(args[2]));
+	boolean built = parseFields(args[5], builder);
+	builder.swapMessage(request.message);
+	if(!built) {
+		releaseRequest(id);
+		publish(copy);
+		return;
+	}
+	// behind the last waiting message of the port
+	request.next = MCGATEWAYNOREQUEST;
+	if(port->queueTail == MCGATEWAYNOREQUEST)
+		port->queueHead = id;
+	else
+		requests[port->queueTail].next = id;
+	port->queueTail = id;
+	servePort(*port);
+}
+static void readClient(uint8_t id) {
+	MCClient &client = clients[id];
+	ssize_t got = recv(client.fd, &client.line[client.lineSize], (sizeof(client.line)-1-client.lineSize), 0);
+	if(got <= 0) {
+		close(client.fd);
+		clients[id] = clients[--clientCount];
+		return;
+	}
+	client.lineSize += got;
+
+	char *start = client.line, *eol;
+	while((eol = (char*) memchr(start, '\n', (client.lineSize-(start-client.line)))) != NULL) {
+		*eol = 0;
+		if(eol > start && eol[-1] == '\r')
+			eol[-1] = 0;
+		if(*start != 0)
+			sendFromLine(start);
+		start = (eol+1);
+	}
+	client.lineSize -= (start-client.line);
+	memmove(client.line, start, client.lineSize);
+	// a line longer than the buffer can not be a message
+	if(client.lineSize == (sizeof(client.line)-1))
+		client.lineSize = 0;
+}
+
+// setup
+static int openServer(const char *path) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(address.sun_path))
+		return -1;
+	strcpy(address.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0)
+		return -1;
+	unlink(path);
+	if(bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(fd, 8) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+static boolean openPort(char *spec, uint8_t engine, boolean fec, uint8_t address) {
+	// <path>[:<baud>[:<maxBaud>]]
+	unsigned long baud = MCGATEWAYBAUD, maxBaud = 0;
+	char *colon = strchr(spec, ':');
+	if(colon != NULL) {
+		*colon = 0;
+		baud = strtoul((colon+1), &colon, 10);
+		if(*colon == ':')
+			maxBaud = strtoul((colon+1), NULL, 10);
+	}
+
+	MCPort &port = ports[portCount];
+	port.path = spec;
+	port.serial = new HardwareSerial(spec);
+	port.serial->begin(baud);
+	if(!*port.serial)
+		return 0;
+
+	port.mc = new MessageComLite(*port.serial, port.buffer, MCGATEWAYFRAME, port.msg, MCGATEWAYMSG);
+	port.mc->setRxQueue(port.rxQueue, MCGATEWAYRXSLOTS);
+	port.mc->setChecksumEngine(engine);
+	port.mc->setErrorCorrection(fec);
+	if(address != 0)
+		port.mc->setAddress(address);
+	// the timeout of sendAsync() counts the time the frame needs at this baud rate
+	port.mc->setLink(baud, ((maxBaud > baud) ? maxBaud : 0));
+	port.queueHead = MCGATEWAYNOREQUEST;
+	port.queueTail = MCGATEWAYNOREQUEST;
+	portCount++;
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	uint8_t engine = MCCHECKCRC16, address = 0;
+	boolean fec = 0;
+	int option;
+	while((option = getopt(argc, argv, "c:ea:")) != -1) {
+		if(option == 'c' && strcmp(optarg, "fletcher16") == 0)
+			engine = MCCHECKFLETCHER16;
+		else if(option == 'c' && strcmp(optarg, "crc32c") == 0)
+			engine = MCCHECKCRC32C;
+		else if(option == 'c' && strcmp(optarg, "crc16") == 0)
+			engine = MCCHECKCRC16;
+		else if(option == 'e')
+			fec = 1;
+		else if(option == 'a')
+			address = (uint8_t) strtoul(optarg, NULL, 0);
+		else
+			optind = argc;
+	}
+	if((argc-optind) < 2 || (argc-optind-1) > MCGATEWAYMAXPORTS) {
+		fprintf(stderr, "Usage: %s [-c crc16|fletcher16|crc32c] [-e] [-a <address>] <socket> <port>[:<baud>[:<maxBaud>]] [...]\n", argv[0]);
+		return 1;
+	}
+
+	if((server = openServer(argv[optind])) < 0) {
+		fprintf(stderr, "Could not open %s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+	for(int i=(optind+1); i<argc; i++) {
+		if(!openPort(argv[i], engine, fec, address)) {
+			fprintf(stderr, "Could not open %s in READ/WRITE mode\n", argv[i]);
+			return 1;
+		}
+	}
+	signal(SIGPIPE, SIG_IGN);
+	initRequests();
+	// the builder keeps room for the parity like the ports
+	builder.setChecksumEngine(engine);
+	builder.setErrorCorrection(fec);
+
+	struct pollfd fds[(1+MCGATEWAYMAXPORTS+MCGATEWAYMAXCLIENTS)];
+	while(1) {
+		// wait for bytes from any port or client, but not longer than MCTIMER
+		// the ports are served after every wait, for the timeouts of their acknowledgements
+		nfds_t count = 0;
+		fds[count].fd = server;
+		fds[count++].events = POLLIN;
+		for(uint8_t i=0; i<portCount; i++) {
+			fds[count].fd = ports[i].serial->getFd();
+			fds[count++].events = POLLIN;
+		}
+		for(uint8_t i=0; i<clientCount; i++) {
+			fds[count].fd = clients[i].fd;
+			fds[count++].events = POLLIN;
+		}
+		if(poll(fds, count, MCTIMER) < 0 && errno != EINTR)
+			break;
+
+		// the clients accepted now were not polled
+		uint8_t polled = clientCount;
+		if(fds[0].revents & POLLIN) {
+			int fd = accept(server, NULL, NULL);
+			if(fd >= 0 && clientCount < MCGATEWAYMAXCLIENTS) {
+				clients[clientCount].fd = fd;
+				clients[clientCount++].lineSize = 0;
+			} else if(fd >= 0) {
+				close(fd);
+			}
+		}
+		// backwards, readClient() moves the last client into the place of a closed one
+		for(int i=(polled-1); i>=0; i--) {
+			if(fds[(1+portCount+i)].revents & (POLLIN | POLLHUP | POLLERR))
+				readClient((uint8_t) i);
+		}
+		for(uint8_t i=0; i<portCount; i++)
+			servePort(ports[i]);
+	}
+	return 1;
+}
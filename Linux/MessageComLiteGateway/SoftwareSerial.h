@@ -0,0 +1,37 @@
+/*
+	SoftwareSerial.h
+
+	Linux has no software serial, every tty is a HardwareSerial.
+	The type is only there so MessageComLite.h builds unchanged.
+
+	@version 0.5
+
+	@link https://github.com/sigger/MessageComLite
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef SoftwareSerial_h
+#define SoftwareSerial_h
+
+#include <Arduino.h>
+
+class SoftwareSerial : public HardwareSerial {
+	public:
+		SoftwareSerial(const char *path) : HardwareSerial(path) {}
+		boolean listen() { return 1; }
+};
+
+#endif
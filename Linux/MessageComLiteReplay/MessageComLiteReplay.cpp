@@ -0,0 +1,197 @@
+/*
+	MessageComLiteReplay.cpp
+
+	Replays a capture written by the Arduino library (setCapture) on Linux.
+	Every frame of the capture runs through readMsg() of the C++ library,
+	so the frames are parsed, checked and corrected exactly like on the node.
+	The capture is mapped into memory, nothing is copied but the frame being parsed.
+
+	Build, the headers of the gateway stand in for the Arduino core:
+		g++ -O2 -march=native -I../MessageComLiteGateway -I../../Arduino/MessageComLite -o MessageComLiteReplay \
+			../MessageComLiteGateway/Arduino.cpp ../../Arduino/MessageComLite/MessageComLite.cpp MessageComLiteReplay.cpp
+	add -DMCLARGEFRAMES if the nodes use large frames.
+
+	Usage:
+		MessageComLiteReplay [-c crc16|fletcher16|crc32c] [-e] [-k] [-q] <capture>
+	-c, -e and -k choose the checksum engine, the error correction and the acknowledgement in the frame
+	the node used, -q prints the summary only.
+
+	Capture format: "MCC1", then records of
+		direction (0: received, 1: sent) | timestamp in ms (4 bytes, high byte first) | length | bytes
+	Output, one line per frame and a summary:
+		<rx|tx> <timestamp> ok <type> <taskValue> <state> <size>
+		<rx|tx> <timestamp> error
+		frames <count> errors <count> frames/s <rate>
+
+	@version 0.5
+
+	@link https://github.com/sigger/MessageComLite
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public
+	License along with this library; if not, write to the Free Software
+	Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <MessageComLite.h>
+
+// encoded and decoded size of the longest message
+#ifdef MCLARGEFRAMES
+	#define MCREPLAYFRAME 1024
+#else
+	#define MCREPLAYFRAME 255
+#endif
+// the frame also holds '#', the parity mark, ';' and the NUL
+#define MCREPLAYMSG (((MCREPLAYFRAME-4)/4)*3)
+// record: direction | timestamp | length
+#define MCREPLAYRECORD 6
+
+// the frame of a direction collected so far, from its start delimiter on
+struct MCStream {
+	uint8_t frame[MCREPLAYFRAME];
+	MCSize size;
+	// longer than MCREPLAYFRAME: an error once it ends
+	boolean overflow;
+};
+
+static uint8_t buffer[(MCREPLAYFRAME+1)];
+static uint8_t msg[MCREPLAYMSG];
+static uint8_t parsed[(MCREPLAYFRAME+1)];
+static MCStream streams[2];
+
+static unsigned long frames = 0;
+static unsigned long errors = 0;
+static boolean quiet = 0;
+
+static void replayFrame(MessageComLite &mc, uint8_t direction, uint32_t timestamp) {
+	MCStream &stream = streams[direction];
+	frames++;
+	// readMsg() reads up to the end of the buffer and corrects in place
+	boolean ok = 0;
+	if(!stream.overflow) {
+		memset(parsed, 0, sizeof(parsed));
+		memcpy(parsed, stream.frame, stream.size);
+		ok = mc.readMsg(parsed);
+	}
+	if(!ok)
+		errors++;
+	if(quiet)
+		return;
+	if(ok)
+		printf("%s %lu ok %u %u %u %u\n", ((direction == MCCAPTURETX) ? "tx" : "rx"), (unsigned long) timestamp,
+			mc.getType(), mc.getTaskValue(), mc.getState(), (unsigned int) mc.getSize());
+	else
+		printf("%s %lu error\n", ((direction == MCCAPTURETX) ? "tx" : "rx"), (unsigned long) timestamp);
+}
+static void replayByte(MessageComLite &mc, uint8_t direction, uint32_t timestamp, uint8_t value) {
+	// like authMsg on the Arduino a frame begins at the last start before the stop
+	MCStream &stream = streams[direction];
+	if(value == '#') {
+		stream.size = 0;
+		stream.overflow = 0;
+	} else if(stream.size == 0) {
+		// acknowledgements and line ends between the frames
+		return;
+	}
+	if(stream.size < MCREPLAYFRAME)
+		stream.frame[stream.size++] = value;
+	else
+		stream.overflow = 1;
+	if(value == ';') {
+		replayFrame(mc, direction, timestamp);
+		stream.size = 0;
+	}
+}
+
+int main(int argc, char **argv) {
+	uint8_t engine = MCCHECKCRC16;
+	boolean fec = 0, ackFrame = 0;
+	int option;
+	while((option = getopt(argc, argv, "c:ekq")) != -1) {
+		if(option == 'c' && strcmp(optarg, "fletcher16") == 0)
+			engine = MCCHECKFLETCHER16;
+		else if(option == 'c' && strcmp(optarg, "crc32c") == 0)
+			engine = MCCHECKCRC32C;
+		else if(option == 'c' && strcmp(optarg, "crc16") == 0)
+			engine = MCCHECKCRC16;
+		else if(option == 'e')
+			fec = 1;
+		else if(option == 'k')
+			ackFrame = 1;
+		else if(option == 'q')
+			quiet = 1;
+		else
+			optind = argc;
+	}
+	if((argc-optind) != 1) {
+		fprintf(stderr, "Usage: %s [-c crc16|fletcher16|crc32c] [-e] [-k] [-q] <capture>\n", argv[0]);
+		return 1;
+	}
+
+	const char *path = argv[optind];
+	int fd = open(path, O_RDONLY);
+	struct stat info;
+	if(fd < 0 || fstat(fd, &info) != 0) {
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	size_t length = (size_t) info.st_size;
+	const uint8_t *capture = NULL;
+	if(length > 0)
+		capture = (const uint8_t*) mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(capture == MAP_FAILED || length < 4 || memcmp(capture, MCCAPTUREMAGIC, 4) != 0) {
+		fprintf(stderr, "%s is no capture\n", path);
+		return 1;
+	}
+	madvise((void*) capture, length, MADV_SEQUENTIAL);
+
+	// the library never touches the port, it only parses
+	HardwareSerial serial("/dev/null");
+	MessageComLite mc(serial, buffer, MCREPLAYFRAME, msg, MCREPLAYMSG);
+	mc.setChecksumEngine(engine);
+	mc.setErrorCorrection(fec);
+	mc.setAckInFrame(ackFrame);
+
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	size_t pos = 4;
+	while((pos+MCREPLAYRECORD) <= length) {
+		uint8_t direction = (capture[pos] & 0x01);
+		uint32_t timestamp = (((uint32_t) capture[(pos+1)] << 24) | ((uint32_t) capture[(pos+2)] << 16) |
+			((uint32_t) capture[(pos+3)] << 8) | capture[(pos+4)]);
+		size_t size = capture[(pos+5)];
+		pos += MCREPLAYRECORD;
+		// a record cut off at the end of the file
+		if((pos+size) > length)
+			size = (length-pos);
+		for(size_t i=0; i<size; i++)
+			replayByte(mc, direction, timestamp, capture[(pos+i)]);
+		pos += size;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = ((end.tv_sec-begin.tv_sec)+((end.tv_nsec-begin.tv_nsec)/1e9));
+
+	printf("frames %lu errors %lu frames/s %.0f\n", frames, errors, ((elapsed > 0) ? (frames/elapsed) : 0));
+	munmap((void*) capture, length);
+	return ((errors > 0) ? 2 : 0);
+}
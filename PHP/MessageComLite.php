@@ -178,6 +178,21 @@ define("MCMAXTRY", 5);
 define("MCACKCOUNT", 10);
 define("MCACKMINAMOUNT", 6);
 
+// large frames (MCLARGEFRAMES in the Arduino library): own version, 2 bytes for dataSize
+define("MCVERSION", 2);
+define("MCLARGEVERSION", 3);
+
+// compact header, 1st byte: flags and type (see the Arduino library)
+define("MCCOMPACT", 0x80);
+define("MCCOMPACTFRAGMENTS", 0x40);
+define("MCCOMPACTADDRESS", 0x20);
+define("MCCOMPACTTYPE", 0x1F);
+
+// addressing: the destination follows the 1st byte of a compact header
+// 1 to 127: a node, 128 to 254: a group, 255: all nodes, 0: no address
+define("MCGROUP", 0x80);
+define("MCBROADCAST", 0xFF);
+
 class MessageComLite {
 	///////////
 	// private
@@ -212,6 +227,10 @@ class MessageComLite {
 	// nack sign
 	private $_nackChar;
 
+	// regular header: 6 bytes, 7 with large frames
+	private $_largeFrames;
+	private $_headerSize;
+
 	// identification
 	private $_version;
 	private $_type;
@@ -226,6 +245,11 @@ class MessageComLite {
 	// dataSize
 	private $_dataSize;
 
+	// addressing on a bus
+	private $_address;
+	private $_group;
+	private $_recvDestination;
+
 	// checksum
 	private $_checksum;
 	private $_csH;
@@ -295,13 +319,23 @@ class MessageComLite {
 		$this->_filePath = $filePath;
 		$this->_fd = &$fd;
 
-		$this->clear();
+		$this->_address = 0;
+		$this->_group = 0;
+
+		$this->setLargeFrames(0);
 	}
 
 	public function getSize() {
 		return $this->_size;
 	}
 
+	public function setLargeFrames($large) {
+		// talk to a device built with MCLARGEFRAMES, pass larger sizes to the constructor as well
+		$this->_largeFrames = $large;
+		$this->_headerSize = ($large ? 7 : 6);
+		$this->clear();
+	}
+
 	// clean up
 	public function clear() {
 		// clear msg
@@ -315,11 +349,12 @@ class MessageComLite {
 		$this->_bufferSize = 0;
 		$this->_size = 0;
 
-		$this->_version = 2;
+		$this->_version = ($this->_largeFrames ? MCLARGEVERSION : MCVERSION);
 		$this->_type = 0;
 
 		$this->_messageNumber = 1;
 		$this->_totalQuantity = 1;
+		$this->_recvDestination = 0;
 
 		$this->_dataCount = 0;
 		$this->_nextData = 0;
@@ -362,11 +397,28 @@ class MessageComLite {
 			$dest[$cnt++] = $src[$i];
 		return 1;
 	}
+	private function getSizeBytes() {
+		return ($this->_largeFrames ? 2 : 1);
+	}
+	private function isArrayAt($pos) {
+		// an array field of the device is marked by the delimiter in front of its size (high byte first)
+		return (($pos+$this->getSizeBytes()) < $this->_dataSize && $this->_data[$pos] === ord($this->_delimiter));
+	}
+	private function getArrayEndAt($pos) {
+		// the delimiter search of a field starts behind the values of an array, they may contain the delimiter
+		if(!$this->isArrayAt($pos))
+			return $pos;
+		$size = $this->_data[($pos+1)];
+		if($this->_largeFrames)
+			$size = (($size << 8) | $this->_data[($pos+2)]);
+		return min(($pos+1+$this->getSizeBytes()+$size), $this->_dataSize);
+	}
 	public function getIndexedArrayFromData($index, &$len) {
 		$start = 0; $stop = 0;
 		
 		for($i=0; $i<=$index; $i++) {
-			if(($stop = $this->indexOf($this->_data, ord($this->_delimiter), $start, $this->_dataSize)) < 0) {
+			$stop = $this->indexOf($this->_data, ord($this->_delimiter), $this->getArrayEndAt($start), $this->_dataSize);
+			if($stop < 0 || $stop >= $this->_dataSize) {
 				$stop = $this->_dataSize;
 				break;
 			}
@@ -374,6 +426,9 @@ class MessageComLite {
 				break;
 			$start = $stop+1;
 		}
+		// the field of an array starts at its values
+		if($this->isArrayAt($start))
+			$start += (1+$this->getSizeBytes());
 		$len = (($stop-$start)+1);
 		
 		if($len > 1) {
@@ -409,6 +464,9 @@ class MessageComLite {
 	public function setType($type) {
 		$this->_type = $type;
 	}
+	public function getType() {
+		return $this->_type;
+	}
 
 	// Command Status
 	public function getCommandStatusFromMessage() {
@@ -464,7 +522,12 @@ class MessageComLite {
 	// DataSize
 	public function getDataSizeFromMessage() {
 		// read the $this->_dataSize from the message
-		$this->_dataSize = $this->_msg[5];
+		$this->_dataSize = $this->getSizeFrom($this->_msg);
+	}
+	private function getSizeFrom($array, $startPos=0) {
+		if($this->_largeFrames)
+			return (($array[($startPos+5)] << 8) | $array[($startPos+6)]);
+		return $array[($startPos+5)];
 	}
 	public function setDataSize($dataSize) {
 		$this->_dataSize = $dataSize;
@@ -475,7 +538,7 @@ class MessageComLite {
 		// read $this->_data from the message
 		if(0 < $this->_dataSize && ($this->_dataSize <= $this->_maxSize)) {
 			for($i=0; $i<$this->_dataSize; $i++)
-				$this->_data[$i] = $this->_msg[(6+$i)];
+				$this->_data[$i] = $this->_msg[($this->_headerSize+$i)];
 		}
 	}
 
@@ -639,8 +702,9 @@ class MessageComLite {
 			return 1;
 		} else if($this->_dataSize > 1) {
 			while(1) {
-				if(($stop = $this->indexOf($this->_data, ord($this->_delimiter), $start, $this->_dataSize)) < 0)
-					break; 
+				$stop = $this->indexOf($this->_data, ord($this->_delimiter), $this->getArrayEndAt($start), $this->_dataSize);
+				if($stop < 0 || $stop >= $this->_dataSize)
+					break;
 				$cnt++;
 				$start = $stop+1;
 			}
@@ -688,11 +752,11 @@ class MessageComLite {
 	// Checksum
 	public function getCsHFromMessage() {
 		// read the $this->_csH from the message
-		$this->_csH = $this->_msg[(6+$this->_dataSize)];
+		$this->_csH = $this->_msg[($this->_headerSize+$this->_dataSize)];
 	}
 	public function getCsLFromMessage() {
 		// read the $this->_csL from the message
-		$this->_csL = $this->_msg[(7+$this->_dataSize)];
+		$this->_csL = $this->_msg[($this->_headerSize+1+$this->_dataSize)];
 	}
 	public function getChecksumFromMessage() {
 		// read the $this->_csL from the message
@@ -708,7 +772,7 @@ class MessageComLite {
 	public function getChecksumFrom($array, $startPos=0) {
 		// read the $this->_csL from the message
 // print "getChecksumFrom relative POS: ";
-		$tmpPos = ($startPos+($array[($startPos+5)])+6);
+		$tmpPos = ($startPos+$this->getSizeFrom($array, $startPos)+$this->_headerSize);
 // var_dump($tmpPos);
 		$csH = $array[$tmpPos];
 		$csL = $array[($tmpPos+1)];
@@ -721,7 +785,7 @@ class MessageComLite {
 	public function makeCrcFrom($array, $startPos=0) {
 		$retval = 0xffff;
 		// get the checksum for the whole message
-		for($i=($startPos); $i<=($startPos+5+$this->_dataSize); $i++) {
+		for($i=($startPos); $i<($startPos+$this->_headerSize+$this->_dataSize); $i++) {
 // print "<pre>";
 // var_dump(dechex($retval));
 // print "</pre>";
@@ -828,22 +892,27 @@ class MessageComLite {
 		$this->_totalQuantity = $totalQuantity;
 
 		// create a message and debug it.
-		if(($this->_size+8) <= $this->_maxSize) {
+		if(($this->_size+$this->_headerSize+2) <= $this->_maxSize) {
 
-			$this->_size = (8+$this->_dataSize);
+			$this->_size = ($this->_headerSize+2+$this->_dataSize);
 
 			$this->_msg[0] = $this->_version;
 			$this->_msg[1] = $this->_type;
 			$this->_msg[2] = $this->_commandStatus;
 			$this->_msg[3] = $this->_messageNumber;
 			$this->_msg[4] = $this->_totalQuantity;
-			$this->_msg[5] = $this->_dataSize;
+			if($this->_largeFrames) {
+				$this->_msg[5] = ($this->_dataSize >> 8);
+				$this->_msg[6] = ($this->_dataSize & 0xFF);
+			} else {
+				$this->_msg[5] = $this->_dataSize;
+			}
 			for($i=0; $i<$this->_dataSize; $i++) {
 // print "<pre>";
 // print "@createMessage, this->_data[i]:<br />";
 // var_dump($this->_data[$i]);
 // print "</pre>";
-				$this->_msg[(6+$i)] = $this->_data[$i];
+				$this->_msg[($this->_headerSize+$i)] = $this->_data[$i];
 			}
 // for($i=0; $i<$this->_dataSize; $i++) {
 //  // print "<pre>";
@@ -853,8 +922,8 @@ class MessageComLite {
 //  $this->_msg[(6+$i)] = $this->_data[$i];
 // }
 			$this->setCrc();
-			$this->_msg[(6+$this->_dataSize)] = $this->_csH;
-			$this->_msg[(6+$this->_dataSize+1)] = $this->_csL;
+			$this->_msg[($this->_headerSize+$this->_dataSize)] = $this->_csH;
+			$this->_msg[($this->_headerSize+$this->_dataSize+1)] = $this->_csL;
 
 			$str = base64_encode($this->arrayToByteString($this->_msg, $this->_size));
 			$this->_buffer = ($this->_startDelimiter.$str.$this->_stopDelimiter);
@@ -865,17 +934,44 @@ class MessageComLite {
 
 
 
+	// addressing on a bus: messages to other nodes are not taken
+	public function setAddress($address) {
+		// 0: the host takes every message
+		$this->_address = $address;
+	}
+	public function setGroup($group) {
+		// the host takes the messages to its group as well, 0: no group
+		if($group != 0)
+			$group |= MCGROUP;
+		$this->_group = $group;
+	}
+	public function getRecvDestination() {
+		return $this->_recvDestination;
+	}
+	public function addressedToMe($destination) {
+		if($this->_address == 0 || $destination == 0 || $destination == MCBROADCAST)
+			return 1;
+		return ($destination == $this->_address || ($this->_group != 0 && $destination == $this->_group));
+	}
+
+	public function getFrame() {
+		// the message encoded by createMessage(), it does not depend on the port
+		return $this->_buffer;
+	}
+
 	public function authMsg($array) {
-		$firstPos = $this->indexOf($array, $this->_startDelimiter, 0, strlen($array)); // $this->_bufferMaxSize);
-		if($firstPos > -1) {
+		// strpos runs in C, so the delimiters are not searched char by char in PHP
+		$firstPos = strpos($array, $this->_startDelimiter);
+		if($firstPos !== false) {
 // print "<pre>start found?: ".$firstPos."</pre>";
 			// start char found
-			$nextPos = $this->indexOf($array, $this->_stopDelimiter, ($firstPos+10), strlen($array)); // $this->_bufferMaxSize);
-			if($nextPos > -1) {
+			// the shortest message (compact header, no data) takes 8 chars
+			$nextPos = (strlen($array) > ($firstPos+9)) ? strpos($array, $this->_stopDelimiter, ($firstPos+9)) : false;
+			if($nextPos !== false) {
 // print "<pre>end found?: ".$nextPos."</pre>";
 				// maybe stop char found
 				// check the length of the message
-				if(($nextPos-$firstPos) >= 11) {
+				if(($nextPos-$firstPos) >= 9) {
 // print "<pre>min Dist ok!: ".($nextPos-$firstPos)."</pre>";
 
 					// authentificate message
@@ -886,9 +982,20 @@ class MessageComLite {
 
 					// convert string to 1 byte array
 					$this->_msg = $this->stringToByteArray($str);
+					// only a compact header carries a destination
+					$this->_recvDestination = 0;
+
+					if(($this->_msg[0] & MCCOMPACT) != 0) {
+						// compact header: verify it and bring it into the regular layout
+						if($this->expandCompactMessage())
+							return 1;
+						$this->clear();
+						return 0;
+					}
+
 					// get data size from message
 					$this->getDataSizeFromMessage();
-					$this->_size = (8+$this->_dataSize);
+					$this->_size = ($this->_headerSize+2+$this->_dataSize);
 
 // print "now PRINT!   ";
 // $this->dPrintMsg();
@@ -898,7 +1005,7 @@ class MessageComLite {
 // print "<pre>message authentic!</pre>";
 							// message authentic!
 							// copy message into $this->_msg
-							$this->_size = ($this->_dataSize+8);
+							$this->_size = ($this->_dataSize+$this->_headerSize+2);
 							return 1;
 						} 
 // else {
@@ -916,6 +1023,45 @@ class MessageComLite {
 		$this->clear();
 		return 0;
 	}
+	private function expandCompactMessage() {
+		$frame = $this->_msg;
+		// the destination of a bus message follows the 1st byte
+		$address = (($frame[0] & MCCOMPACTADDRESS) != 0) ? 1 : 0;
+		if($address && (count($frame) < 2 || !$this->addressedToMe($frame[1])))
+			return 0;
+		$headerSize = ((($frame[0] & MCCOMPACTFRAGMENTS) != 0) ? 4 : 2)+$address;
+		// the compact header has no size byte, the size follows from the frame length
+		$dataSize = (count($frame)-$headerSize-2);
+		if($dataSize < 0)
+			return 0;
+
+		// verify the transmitted checksum over the compact header and the data
+		$checksum = 0xffff;
+		for($i=0; $i<($headerSize+$dataSize); $i++)
+			$checksum = CRC16Inverse($checksum, chr($frame[$i]));
+		if($checksum != joinValue(array($frame[($headerSize+$dataSize)], $frame[($headerSize+$dataSize+1)])))
+			return 0;
+
+		// regular layout: version | type | commandStatus | messageNumber | totalQuantity | dataSize | data | csH | csL
+		$this->_msg = array(
+			$this->_version,
+			($frame[0] & MCCOMPACTTYPE),
+			$frame[(1+$address)],
+			((($frame[0] & MCCOMPACTFRAGMENTS) != 0) ? $frame[(2+$address)] : 1),
+			((($frame[0] & MCCOMPACTFRAGMENTS) != 0) ? $frame[(3+$address)] : 1)
+		);
+		if($this->_largeFrames)
+			$this->_msg[] = ($dataSize >> 8);
+		$this->_msg[] = ($dataSize & 0xFF);
+		for($i=$headerSize; $i<count($frame); $i++)
+			$this->_msg[] = $frame[$i];
+
+		$this->_dataSize = $dataSize;
+		$this->_size = ($dataSize+$this->_headerSize+2);
+		$this->_recvDestination = ($address ? $frame[1] : 0);
+		return 1;
+	}
+
 	public function readMsg($buffer) {
 		if($this->authMsg($buffer)) {
 			$this->gatherInfoFromMessage();
@@ -979,6 +1125,9 @@ class MessageComLite {
 	public function receive() {
 		if($this->recv()) {
 // print "receive, recv OK!!!! ";
+			// nobody answers a message to a group or to all nodes, the answers would collide
+			if(($this->_recvDestination & MCGROUP) != 0)
+				return $this->getState();
 			if($this->getState()) {
 				$this->sendAck(1);
 				return 1;
@@ -993,8 +1142,12 @@ class MessageComLite {
 // print "send: ";
 // var_dump($this->_buffer);
 // $this->dPrintMsg();
+		$this->sndFrame($this->_buffer);
+	}
+	public function sndFrame($frame) {
+		// send a message encoded before, see getFrame()
 		fputs($this->_fd, PHP_EOL);
-		fputs($this->_fd, $this->_buffer, strlen($this->_buffer));
+		fputs($this->_fd, $frame, strlen($frame));
 		fputs($this->_fd, PHP_EOL);
 	}
 	public function sendAck($state) {